@@ -0,0 +1,196 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+
+// 分配轨迹记录: 以 -DCMP_ALLOC_TRACE=1 编译时, ConcurrentAlloc/ConcurrentFree
+// 的每一次调用都会写入线程私有的环形缓冲区, 缓冲区写满或线程退出时批量追加到
+// 轨迹文件 (默认 cmp_alloc_trace.bin, 可用环境变量 CMP_TRACE_FILE 指定).
+// 文件格式: TraceFileHeader + 若干 TraceRecord, 由 bench/trace_replay.cc 回放.
+namespace cmp
+{
+namespace trace
+{
+static const uint32_t kTraceMagic = 0x54504d43; // "CMPT"
+static const uint32_t kTraceVersion = 1;
+static const size_t kTraceBufferRecords = 4096;
+
+enum TraceOp
+{
+    kTraceAlloc = 1,
+    kTraceFree = 2
+};
+
+struct TraceFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t reserved;
+};
+
+struct TraceRecord
+{
+    uint64_t seq;         // 全局顺序号, 回放时据此还原线程交错
+    uint64_t timestampNs; // steady_clock 时间戳
+    uint64_t ptrId;       // 指针地址, 用于配对分配与释放
+    uint32_t size;        // 申请字节数 (超过 4GB 时截断为 UINT32_MAX)
+    uint16_t thread;      // 进程内线程编号, 从 0 开始
+    uint8_t op;           // TraceOp
+    uint8_t reserved;
+};
+
+class TraceWriter
+{
+public:
+    static TraceWriter *GetInstance()
+    {
+        static TraceWriter inst;
+        return &inst;
+    }
+
+    uint64_t NextSeq()
+    {
+        return _seq.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint16_t NextThreadId()
+    {
+        return static_cast<uint16_t>(_threadIds.fetch_add(1, std::memory_order_relaxed));
+    }
+
+    void Write(const TraceRecord *records, size_t n)
+    {
+        if (n == 0)
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (!Open())
+        {
+            return;
+        }
+        fwrite(records, sizeof(TraceRecord), n, _file);
+    }
+
+    ~TraceWriter()
+    {
+        if (_file != nullptr)
+        {
+            fclose(_file);
+        }
+    }
+
+private:
+    TraceWriter()
+    {
+    }
+
+    TraceWriter(const TraceWriter &) = delete;
+
+    bool Open()
+    {
+        if (_file != nullptr)
+        {
+            return true;
+        }
+        if (_openFailed)
+        {
+            return false;
+        }
+
+        const char *path = std::getenv("CMP_TRACE_FILE");
+        if (path == nullptr || *path == '\0')
+        {
+            path = "cmp_alloc_trace.bin";
+        }
+
+        _file = fopen(path, "wb");
+        if (_file == nullptr)
+        {
+            _openFailed = true;
+            return false;
+        }
+
+        TraceFileHeader header = {kTraceMagic, kTraceVersion, sizeof(TraceRecord), 0};
+        fwrite(&header, sizeof(header), 1, _file);
+        return true;
+    }
+
+    std::mutex _mtx;
+    FILE *_file = nullptr;
+    bool _openFailed = false;
+    std::atomic<uint64_t> _seq{0};
+    std::atomic<uint32_t> _threadIds{0};
+};
+
+// 线程私有缓冲区, 用 std::malloc 申请, 避免记录过程重新进入内存池
+class TraceBuffer
+{
+public:
+    ~TraceBuffer()
+    {
+        if (_records != nullptr)
+        {
+            Flush();
+            std::free(_records);
+        }
+    }
+
+    void Append(uint8_t op, void *ptr, size_t size)
+    {
+        if (_records == nullptr)
+        {
+            _records = static_cast<TraceRecord *>(std::malloc(sizeof(TraceRecord) * kTraceBufferRecords));
+            if (_records == nullptr)
+            {
+                return;
+            }
+            _thread = TraceWriter::GetInstance()->NextThreadId();
+        }
+
+        TraceRecord &rec = _records[_count];
+        rec.seq = TraceWriter::GetInstance()->NextSeq();
+        rec.timestampNs = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch())
+                .count());
+        rec.ptrId = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(ptr));
+        rec.size = size > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(size);
+        rec.thread = _thread;
+        rec.op = op;
+        rec.reserved = 0;
+
+        if (++_count == kTraceBufferRecords)
+        {
+            Flush();
+        }
+    }
+
+    void Flush()
+    {
+        TraceWriter::GetInstance()->Write(_records, _count);
+        _count = 0;
+    }
+
+private:
+    TraceRecord *_records = nullptr;
+    size_t _count = 0;
+    uint16_t _thread = 0;
+};
+
+inline void Record(uint8_t op, void *ptr, size_t size)
+{
+    // 先构造 writer, 保证它比主线程的 thread_local 缓冲区后析构
+    TraceWriter::GetInstance();
+    static thread_local TraceBuffer buffer;
+    buffer.Append(op, ptr, size);
+}
+
+} // namespace trace
+} // namespace cmp
@@ -19,6 +19,11 @@ inline T *AllocateRaw(std::size_t n = 1)
     }
 
     void *mem = ConcurrentAlloc(sizeof(T) * n);
+    if (mem == nullptr)
+    {
+        // 超过内存硬上限
+        throw std::bad_alloc();
+    }
     return static_cast<T *>(mem);
 }
 
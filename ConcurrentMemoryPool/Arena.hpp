@@ -0,0 +1,380 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "PageCache.hpp"
+
+namespace cmp
+{
+// 区域(arena)分配器: 直接从 PageCache 拿 span, 在 span 内顺序切分(bump),
+// 单个对象不释放, Rewind/Reset 时按 span 整体归还 PageCache.
+// 适合"一次请求内申请大量小对象, 请求结束后全部失效"的场景,
+// 请求收尾的代价从 O(对象数) 变为 O(span 数).
+// Arena 本身不加锁, 一个 Arena 只能被一个线程使用; 每线程一个可用 ThreadArena().
+// Arena 的内存不能交给 ConcurrentFree.
+class Arena
+{
+public:
+    // 回滚点: 记录当时的 span, 切分位置和析构链, 可嵌套, 按后进先出的顺序回滚
+    struct Checkpoint
+    {
+        Span *_span;
+        char *_cur;
+        void *_cleanups;
+        size_t _bytes;
+    };
+
+    explicit Arena(size_t initPages = 1, size_t maxPages = 32)
+        : _initPages(ClampPages(initPages)),
+          _maxPages(ClampPages(maxPages < initPages ? initPages : maxPages)),
+          _nextPages(_initPages)
+    {
+    }
+
+    ~Arena()
+    {
+        Reset();
+    }
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *Allocate(size_t bytes, size_t align = alignof(std::max_align_t))
+    {
+        assert(align != 0 && (align & (align - 1)) == 0);
+        if (bytes == 0)
+        {
+            bytes = 1;
+        }
+
+        char *ptr = AlignUp(_cur, align);
+        if (_cur == nullptr || ptr > _end || bytes > (size_t)(_end - ptr))
+        {
+            NewBlock(bytes, align);
+            ptr = AlignUp(_cur, align);
+        }
+
+        _cur = ptr + bytes;
+        _bytes += bytes;
+        return ptr;
+    }
+
+    // 构造对象; 非平凡析构的类型会登记析构函数, 在 Rewind/Reset 时逆序调用
+    template <class T, class... Args>
+    T *New(Args &&...args)
+    {
+        Cleanup *cleanup = nullptr;
+        if (!std::is_trivially_destructible<T>::value)
+        {
+            cleanup = static_cast<Cleanup *>(Allocate(sizeof(Cleanup), alignof(Cleanup)));
+        }
+
+        T *obj = new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (cleanup != nullptr)
+        {
+            cleanup->_obj = obj;
+            cleanup->_destroy = &Destroy<T>;
+            cleanup->_next = _cleanups;
+            _cleanups = cleanup;
+        }
+        return obj;
+    }
+
+    template <class T>
+    T *NewArray(size_t n)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "NewArray only supports trivially destructible types");
+        if (n > std::numeric_limits<size_t>::max() / sizeof(T))
+        {
+            throw std::bad_alloc();
+        }
+        T *arr = static_cast<T *>(Allocate(sizeof(T) * n, alignof(T)));
+        for (size_t i = 0; i < n; ++i)
+        {
+            new (arr + i) T();
+        }
+        return arr;
+    }
+
+    Checkpoint Mark() const
+    {
+        Checkpoint cp;
+        cp._span = _spans;
+        cp._cur = _cur;
+        cp._cleanups = _cleanups;
+        cp._bytes = _bytes;
+        return cp;
+    }
+
+    // 回滚到 cp: 调用其后登记的析构函数, 并把其后申请的 span 一次性归还 PageCache.
+    // cp 必须来自当前 Arena, 且晚于最近一次 Reset
+    void Rewind(const Checkpoint &cp)
+    {
+        RunCleanups(static_cast<Cleanup *>(cp._cleanups));
+
+        Span *released = nullptr;
+        while (_spans != cp._span)
+        {
+            assert(_spans != nullptr);
+            Span *span = _spans;
+            _spans = span->_next;
+            span->_next = released;
+            released = span;
+            _spanCount--;
+        }
+        ReleaseSpans(released);
+
+        _cur = cp._cur;
+        _end = _spans != nullptr ? SpanEnd(_spans) : nullptr;
+        _bytes = cp._bytes;
+    }
+
+    // 释放全部内存: 所有 span 在一次 _pageMtx 加锁内归还
+    void Reset()
+    {
+        RunCleanups(nullptr);
+        ReleaseSpans(_spans);
+
+        _spans = nullptr;
+        _cur = nullptr;
+        _end = nullptr;
+        _bytes = 0;
+        _spanCount = 0;
+        _nextPages = _initPages;
+    }
+
+    // memory_resource 风格的接口, 便于适配 std::pmr 或自定义容器
+    void *allocate(size_t bytes, size_t align = alignof(std::max_align_t))
+    {
+        return Allocate(bytes, align);
+    }
+
+    void deallocate(void *, size_t, size_t = alignof(std::max_align_t)) noexcept
+    {
+        // 单个对象不回收, 由 Rewind/Reset 统一释放
+    }
+
+    bool is_equal(const Arena &other) const noexcept
+    {
+        return this == &other;
+    }
+
+    size_t BytesAllocated() const
+    {
+        return _bytes;
+    }
+
+    size_t SpanCount() const
+    {
+        return _spanCount;
+    }
+
+    size_t BytesReserved() const
+    {
+        size_t bytes = 0;
+        for (Span *span = _spans; span != nullptr; span = span->_next)
+        {
+            bytes += span->_n << PAGE_SHIFT;
+        }
+        return bytes;
+    }
+
+private:
+    struct Cleanup
+    {
+        void *_obj;
+        void (*_destroy)(void *);
+        Cleanup *_next;
+    };
+
+    template <class T>
+    static void Destroy(void *obj)
+    {
+        static_cast<T *>(obj)->~T();
+    }
+
+    static size_t ClampPages(size_t pages)
+    {
+        if (pages == 0)
+        {
+            return 1;
+        }
+        return pages < NPAGES - 1 ? pages : NPAGES - 1;
+    }
+
+    static char *AlignUp(char *ptr, size_t align)
+    {
+        return reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(ptr) + align - 1) & ~(uintptr_t)(align - 1));
+    }
+
+    static char *SpanEnd(Span *span)
+    {
+        return reinterpret_cast<char *>((span->_pageID + span->_n) << PAGE_SHIFT);
+    }
+
+    void RunCleanups(Cleanup *stop)
+    {
+        while (_cleanups != nullptr && _cleanups != stop)
+        {
+            Cleanup *cleanup = _cleanups;
+            _cleanups = cleanup->_next;
+            cleanup->_destroy(cleanup->_obj);
+        }
+    }
+
+    // 申请新 span: 页数按 _initPages 起倍增到 _maxPages, 单个大请求按需放大
+    void NewBlock(size_t bytes, size_t align)
+    {
+        if (align > ((size_t)1 << PAGE_SHIFT))
+        {
+            throw std::bad_alloc();
+        }
+        size_t need = (bytes + ((size_t)1 << PAGE_SHIFT) - 1) >> PAGE_SHIFT;
+        size_t k = need > _nextPages ? need : _nextPages;
+        if (_nextPages < _maxPages)
+        {
+            _nextPages = _nextPages * 2 < _maxPages ? _nextPages * 2 : _maxPages;
+        }
+
+        PageCache::GetInstance()->_pageMtx.lock();
+        Span *span = PageCache::GetInstance()->NewSpan(k);
+        PageCache::GetInstance()->_pageMtx.unlock();
+        if (span == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+
+        span->_next = _spans;
+        span->_prev = nullptr;
+        _spans = span;
+        _spanCount++;
+
+        _cur = reinterpret_cast<char *>(span->_pageID << PAGE_SHIFT);
+        _end = SpanEnd(span);
+    }
+
+    static void ReleaseSpans(Span *span)
+    {
+        if (span == nullptr)
+        {
+            return;
+        }
+
+        PageCache::GetInstance()->_pageMtx.lock();
+        while (span != nullptr)
+        {
+            Span *next = span->_next;
+            span->_next = nullptr;
+            PageCache::GetInstance()->ReleaseSpanToPageCache(span);
+            span = next;
+        }
+        PageCache::GetInstance()->_pageMtx.unlock();
+    }
+
+    Span *_spans = nullptr; // 最新的 span 在链表头, 用 span->_next 串起来
+    char *_cur = nullptr;
+    char *_end = nullptr;
+    Cleanup *_cleanups = nullptr;
+    size_t _bytes = 0;
+    size_t _spanCount = 0;
+
+    size_t _initPages;
+    size_t _maxPages;
+    size_t _nextPages;
+};
+
+// 作用域回滚: 构造时打回滚点, 析构时回滚, 可嵌套
+class ArenaScope
+{
+public:
+    explicit ArenaScope(Arena &arena)
+        : _arena(arena), _cp(arena.Mark())
+    {
+    }
+
+    ~ArenaScope()
+    {
+        _arena.Rewind(_cp);
+    }
+
+    ArenaScope(const ArenaScope &) = delete;
+    ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+    Arena &_arena;
+    Arena::Checkpoint _cp;
+};
+
+// 每线程一个 Arena, 线程退出时整体归还
+inline Arena &ThreadArena()
+{
+    static thread_local Arena arena;
+    return arena;
+}
+
+// STL 分配器适配: deallocate 为空操作, 内存随 Arena 回滚/重置释放
+template <class T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template <class U>
+    struct rebind
+    {
+        typedef ArenaAllocator<U> other;
+    };
+
+    explicit ArenaAllocator(Arena &arena = ThreadArena()) noexcept
+        : _arena(&arena)
+    {
+    }
+
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U> &other) noexcept
+        : _arena(other._arena)
+    {
+    }
+
+    pointer allocate(size_type n)
+    {
+        if (n > max_size())
+        {
+            throw std::bad_alloc();
+        }
+        return static_cast<pointer>(_arena->Allocate(sizeof(T) * n, alignof(T)));
+    }
+
+    void deallocate(pointer, size_type) noexcept
+    {
+    }
+
+    size_type max_size() const noexcept
+    {
+        return std::numeric_limits<size_type>::max() / sizeof(T);
+    }
+
+    Arena *_arena;
+};
+
+template <class T, class U>
+inline bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) noexcept
+{
+    return a._arena == b._arena;
+}
+
+template <class T, class U>
+inline bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) noexcept
+{
+    return a._arena != b._arena;
+}
+
+} // namespace cmp
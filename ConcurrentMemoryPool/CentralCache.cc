@@ -0,0 +1,3 @@
+#include "CentralCache.hpp"
+
+CentralCache CentralCache::_sInst CMP_INIT_PRIORITY;
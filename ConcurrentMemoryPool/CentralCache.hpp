@@ -2,8 +2,42 @@
 
 #include "Common.hpp"
 
+#include "Hardened.hpp"
 #include "PageCache.hpp"
 
+// span 按占用率 (_useCount / _capacity) 分成 CENTRAL_OCCUPANCY_BUCKETS 个桶
+static const size_t CENTRAL_OCCUPANCY_BUCKETS = 8;
+// 每从 PageCache 取这么多个 span 做一次稀疏 span 回收
+static const size_t CENTRAL_DRAIN_INTERVAL = 256;
+
+struct CentralOccupancy
+{
+    size_t _spans[CENTRAL_OCCUPANCY_BUCKETS + 1] = {0}; // 最后一项为已满的 span
+    size_t _useObjs = 0;
+    size_t _capacityObjs = 0;
+};
+
+// 转移缓存的一个槽位: 整批对象的链表, 存取都是 O(1), 不需要逐个遍历对象
+struct TransferBatch
+{
+    void* _start = nullptr;
+    void* _end = nullptr;
+    size_t _n = 0;
+};
+
+// 一个尺寸类的中心缓存, 按缓存行对齐, 相邻尺寸类不会共享缓存行.
+// span 锁与 span 链表放在一起, 转移缓存的锁与槽位另起一个缓存行, 两条路径互不干扰
+struct alignas(CACHE_LINE_SIZE) CentralFreeList
+{
+    SpinMutex _mtx;       // 保护 _fullSpans 和 _buckets
+    SpanList _fullSpans;  // 对象全部分出去的 span
+    SpanList _buckets[CENTRAL_OCCUPANCY_BUCKETS];
+
+    alignas(CACHE_LINE_SIZE) SpinMutex _transferMtx;
+    std::atomic<size_t> _transferCount{0}; // 只在锁内修改, 原子类型是为了锁外预判
+    TransferBatch _transfer[CENTRAL_TRANSFER_SLOTS]; // 每个槽位存放线程缓存一次归还的整批对象, 只用前 SizeClassInfo::_transferSlots 个
+};
+
 class CentralCache
 {
 public:
@@ -12,27 +46,29 @@ public:
         return &_sInst;
     }
 
-    Span* GetOneSpan(SpanList& list, size_t size)
+    Span* GetOneSpan(size_t index, size_t size)
     {
-        Span* it = list.Begin();
-        while (it != list.End())
+        // 优先从最满的 span 分配, 稀疏的 span 得不到新的分配, 更容易整块变空后还给 PageCache
+        for (size_t b = CENTRAL_OCCUPANCY_BUCKETS; b > 0; --b)
         {
-            if (it -> _freeList != nullptr)
-            {
-                return it;
-            }
-            else
+            if (!_lists[index]._buckets[b - 1].Empty())
             {
-                it = it->_next;
+                return _lists[index]._buckets[b - 1].Begin();
             }
         }
         //解锁, 不然如果有释放内存回来的无法回来
-        list._mtx.unlock();
+        _lists[index]._mtx.unlock();
 
         //没有空闲Span了 需要从page Cache 获取
         PageCache::GetInstance()->_pageMtx.lock();
-        Span* span = PageCache::GetInstance()->NewSpan(SizeClass::NumMovePage(size));
+        Span* span = PageCache::GetInstance()->NewSpan(SizeClass::Info(index)._pages);
         PageCache::GetInstance()->_pageMtx.unlock();
+        if (span == nullptr)
+        {
+            // 超过硬上限, 恢复加锁状态交给调用方处理
+            _lists[index]._mtx.lock();
+            return nullptr;
+        }
 
         //对span切分,不需要加锁,因为其他线程访问不到这个span
 
@@ -40,24 +76,41 @@ public:
         size_t bytes = span->_n << PAGE_SHIFT; //大块内存大小
         char* end = start + bytes;
 
+        span->_objSize = size;
+        span->_owner.store(nullptr, std::memory_order_relaxed);
         span->_freeList = start;
+        span->_capacity = 1;
         start += size;
         void* tail = span -> _freeList;
-        while(start < end)
+        // 尺寸不能整除 span 大小时, 尾部不足一个对象的空间不能切出去, 否则会越界到相邻的 span
+        while(start + size <= end)
         {
             NextObj(tail) = start;
             tail = NextObj(tail);
             start += size; // 按照size大小切分
+            span->_capacity++;
         }
         NextObj(tail) = nullptr;
-        
+#if CMP_HARDENED
+        cmp::hardened::AttachStates(span);
+#endif
+
+        // 定期把转移缓存里压着稀疏 span 的对象还回去
+        if (_newSpanCount.fetch_add(1, std::memory_order_relaxed) % CENTRAL_DRAIN_INTERVAL == CENTRAL_DRAIN_INTERVAL - 1)
+        {
+            ReleaseSparseSpans();
+        }
+
         // 还回去要加锁
-        list._mtx.lock();
-        list.PushFront(span);
+        _lists[index]._mtx.lock();
+        span->_bucket = 0;
+        _lists[index]._buckets[0].PushFront(span);
         return span;
     }
 
-    size_t FetchRangeObj(void*& start, void*& end, size_t batchNum, size_t size)
+    // owner 非空时把取出对象的 span 标记为属于该线程缓存 (CMP_REMOTE_FREE).
+    // 超过硬上限取不到 span 时返回 0
+    size_t FetchRangeObj(void*& start, void*& end, size_t batchNum, size_t size, void* owner = nullptr)
     {
         size_t index = SizeClass::Index(size);
         size_t transferNum = FetchRangeObjFromTransferCache(index, batchNum, start, end);
@@ -65,28 +118,49 @@ public:
         {
             return transferNum;
         }
+        return FetchRangeObjFromSpans(index, batchNum, size, start, end, owner);
+    }
 
-        _spanLists[index]._mtx.lock();
-
-        Span* span = GetOneSpan(_spanLists[index], size);
-        assert(span);
-        assert(span->_freeList);
-
-        //从span中获取batchNum个对象
-        start = span->_freeList;
-        end = start;
-        size_t actualNum = 1;
-        while (actualNum < batchNum && NextObj(end) != nullptr)
+    // 预热 size (尺寸类大小) 所在的尺寸类: 从 span 切出整批对象, 填满转移缓存的全部槽位.
+    // 之后线程缓存第一次向中心缓存取对象只需拿走一个槽位, 不必切分 span 或等待 PageCache.
+    // 转移缓存同样会被 ReleaseSparseSpans 清空. 返回放入转移缓存的对象数
+    size_t Prewarm(size_t size)
+    {
+        size_t index = SizeClass::Index(size);
+        size_t batchNum = SizeClass::NumMoveSize(size);
+        size_t slots = SizeClass::Info(index)._transferSlots;
+        size_t filled = 0;
+        while (_lists[index]._transferCount.load(std::memory_order_relaxed) < slots)
         {
-            end = NextObj(end);
-            actualNum++;
+            // span 末尾可能不足一批, 从多个 span 凑齐整批, 与线程缓存归还的批大小一致
+            void* start = nullptr;
+            size_t n = 0;
+            while (n < batchNum)
+            {
+                void* first = nullptr;
+                void* last = nullptr;
+                size_t got = FetchRangeObjFromSpans(index, batchNum - n, size, first, last, nullptr);
+                if (got == 0)
+                {
+                    break;
+                }
+                NextObj(last) = start;
+                start = first;
+                n += got;
+            }
+            if (n == 0)
+            {
+                break;
+            }
+            if (!PushRangeObjToTransferCache(index, start, n))
+            {
+                // 其他线程同时填满了槽位
+                ReleaseListToSpans(start, size, n);
+                break;
+            }
+            filled += n;
         }
-        span->_freeList = NextObj(end);
-        NextObj(end) = nullptr;
-        span->_useCount += actualNum;
-        _spanLists[index]._mtx.unlock();
-
-        return actualNum;
+        return filled;
     }
 
     void ReleaseListToSpans(void* start, size_t size, size_t n)
@@ -97,115 +171,275 @@ public:
         }
 
         size_t index = SizeClass::Index(size);
-        size_t cachedNum = PushRangeObjToTransferCache(index, size, start, n);
-        n -= cachedNum;
-        if (n == 0 || start == nullptr)
+        if (PushRangeObjToTransferCache(index, start, n))
         {
             return;
         }
 
-        _spanLists[index]._mtx.lock();
+        _lists[index]._mtx.lock();
         while (start && n > 0)
         {
             void* next = NextObj(start);
-            Span* span = PageCache::GetInstance()->MapObjectToSpan(start); //获取start对象对应的span
-            NextObj(start) = span->_freeList;
-            span->_freeList = start;
-            span->_useCount--;
-            
-            if(span->_useCount == 0)
+            ReleaseObjToSpan(index, start);
+            start = next;
+            --n;
+        }
+        _lists[index]._mtx.unlock();
+    }
+
+    // 转移缓存里的对象在 span 看来仍是 "已分配", 会让本该变空的 span 一直留在中心缓存.
+    // 这里把转移缓存整体还给各自的 span, 变空的 span 归还 PageCache 合并, 其余 span 回到真实的占用率桶里,
+    // 之后的分配会继续偏向较满的 span. 返回归还给 PageCache 的 span 数.
+    // 分配新 span 时每 CENTRAL_DRAIN_INTERVAL 次自动调用一次, 也可以手动触发
+    size_t ReleaseSparseSpans()
+    {
+        size_t released = 0;
+        for (size_t index = 0; index < NFREELIST; ++index)
+        {
+            CentralFreeList& cls = _lists[index];
+            TransferBatch batches[CENTRAL_TRANSFER_SLOTS];
+            size_t count = 0;
+            {
+                std::lock_guard<SpinMutex> lock(cls._transferMtx);
+                count = cls._transferCount.load(std::memory_order_relaxed);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    batches[i] = cls._transfer[i];
+                }
+                cls._transferCount.store(0, std::memory_order_relaxed);
+            }
+            if (count == 0)
             {
-                _spanLists[index].Erase(span); // 从spanList中移除
-                span->_freeList = nullptr;
-                span->_next = nullptr;
-                span->_prev = nullptr;
+                continue;
+            }
 
-                _spanLists[index]._mtx.unlock(); // 如果有其他线程需要使用这个span,需要解锁
+            cls._mtx.lock();
+            for (size_t i = 0; i < count; ++i)
+            {
+                void* list = batches[i]._start;
+                while (list != nullptr)
+                {
+                    void* next = NextObj(list);
+                    released += ReleaseObjToSpan(index, list);
+                    list = next;
+                }
+            }
+            cls._mtx.unlock();
+        }
+        return released;
+    }
 
-                PageCache::GetInstance()->_pageMtx.lock();
-                PageCache::GetInstance()->ReleaseSpanToPageCache(span);
-                PageCache::GetInstance()->_pageMtx.unlock();
+    // fork 前获取所有尺寸类的转移缓存锁和 span 锁 (见 Fork.hpp); 任何路径都不会同时持有其中两把, 按下标顺序加锁即可
+    void LockForFork()
+    {
+        for (size_t index = 0; index < NFREELIST; ++index)
+        {
+            _lists[index]._transferMtx.lock();
+            _lists[index]._mtx.lock();
+        }
+    }
 
-                _spanLists[index]._mtx.lock();
-            }
+    void UnlockForFork()
+    {
+        for (size_t index = NFREELIST; index > 0; --index)
+        {
+            _lists[index - 1]._mtx.unlock();
+            _lists[index - 1]._transferMtx.unlock();
+        }
+    }
 
-            start = next;
-            --n;
+    // 所有尺寸类 span 锁 / 转移缓存锁的计数之和
+    void GetLockStats(LockStats& spanLocks, LockStats& transferLocks)
+    {
+        for (size_t index = 0; index < NFREELIST; ++index)
+        {
+            spanLocks += _lists[index]._mtx.Stats();
+            transferLocks += _lists[index]._transferMtx.Stats();
         }
-        _spanLists[index]._mtx.unlock();
+    }
+
+    // 统计某个尺寸类的 span 占用情况
+    CentralOccupancy GetOccupancy(size_t size)
+    {
+        CentralOccupancy occ;
+        size_t index = SizeClass::Index(size);
+        std::lock_guard<SpinMutex> lock(_lists[index]._mtx);
+        for (size_t b = 0; b <= CENTRAL_OCCUPANCY_BUCKETS; ++b)
+        {
+            SpanList& list = BucketList(index, b);
+            for (Span* it = list.Begin(); it != list.End(); it = it->_next)
+            {
+                occ._spans[b]++;
+                occ._useObjs += it->_useCount;
+                occ._capacityObjs += it->_capacity;
+            }
+        }
+        return occ;
     }
     
 private:
-    size_t FetchRangeObjFromTransferCache(size_t index, size_t batchNum, void*& start, void*& end)
+    // 对象全部分出去的 span 放在 _fullSpans, 其余按占用率放进 _buckets
+    void Relink(size_t index, Span* span)
     {
-        std::lock_guard<std::mutex> lock(_transferMtx[index]);
-        size_t transferSize = _transferLists[index].Size();
-        if (transferSize == 0)
+        size_t bucket = span->_freeList == nullptr ? CENTRAL_OCCUPANCY_BUCKETS
+                                                   : span->_useCount * CENTRAL_OCCUPANCY_BUCKETS / span->_capacity;
+        if (bucket == span->_bucket)
         {
-            start = nullptr;
-            end = nullptr;
+            return;
+        }
+        BucketList(index, span->_bucket).Erase(span);
+        span->_bucket = bucket;
+        BucketList(index, bucket).PushFront(span);
+    }
+
+    SpanList& BucketList(size_t index, size_t bucket)
+    {
+        return bucket < CENTRAL_OCCUPANCY_BUCKETS ? _lists[index]._buckets[bucket] : _lists[index]._fullSpans;
+    }
+
+    // 把一个对象还给所属 span, 调用前后都持有 _lists[index]._mtx; span 变空时归还 PageCache 并返回 1
+    size_t ReleaseObjToSpan(size_t index, void* obj)
+    {
+        Span* span = PageCache::GetInstance()->MapObjectToSpan(obj); //获取obj对象对应的span
+        NextObj(obj) = span->_freeList;
+        span->_freeList = obj;
+        span->_useCount--;
+
+        if (span->_useCount != 0)
+        {
+            Relink(index, span);
             return 0;
         }
 
-        size_t fetchNum = std::min(batchNum, transferSize);
-        start = _transferLists[index].Pop();
+        // 从所在链表中移除
+        BucketList(index, span->_bucket).Erase(span);
+        span->_freeList = nullptr;
+        span->_next = nullptr;
+        span->_prev = nullptr;
+
+        _lists[index]._mtx.unlock(); // 如果有其他线程需要使用这个span,需要解锁
+#if CMP_HARDENED
+        cmp::hardened::DetachStates(span);
+#endif
+
+        PageCache::GetInstance()->_pageMtx.lock();
+        PageCache::GetInstance()->ReleaseSpanToPageCache(span);
+        PageCache::GetInstance()->_pageMtx.unlock();
+
+        _lists[index]._mtx.lock();
+        return 1;
+    }
+
+    // 从最满的 span 取至多 batchNum 个对象, span 都用完时向 PageCache 申请. 超过硬上限时返回 0
+    size_t FetchRangeObjFromSpans(size_t index, size_t batchNum, size_t size, void*& start, void*& end, void* owner)
+    {
+        _lists[index]._mtx.lock();
+
+        Span* span = GetOneSpan(index, size);
+        if (span == nullptr)
+        {
+            _lists[index]._mtx.unlock();
+            start = end = nullptr;
+            return 0;
+        }
+        assert(span->_freeList);
+
+        //从span中获取batchNum个对象
+        start = span->_freeList;
         end = start;
-        for (size_t i = 1; i < fetchNum; ++i)
+        size_t actualNum = 1;
+        while (actualNum < batchNum && NextObj(end) != nullptr)
         {
-            void* obj = _transferLists[index].Pop();
-            NextObj(end) = obj;
-            end = obj;
+            end = NextObj(end);
+            actualNum++;
         }
+        span->_freeList = NextObj(end);
         NextObj(end) = nullptr;
-        return fetchNum;
+        span->_useCount += actualNum;
+        if (owner != nullptr)
+        {
+            span->_owner.store(owner, std::memory_order_relaxed);
+        }
+        Relink(index, span);
+        _lists[index]._mtx.unlock();
+
+        return actualNum;
     }
 
-    size_t PushRangeObjToTransferCache(size_t index, size_t size, void*& start, size_t n)
+    // 取栈顶的一批; 比 batchNum 多时只切走前 batchNum 个, 其余留在槽位里
+    size_t FetchRangeObjFromTransferCache(size_t index, size_t batchNum, void*& start, void*& end)
     {
-        std::lock_guard<std::mutex> lock(_transferMtx[index]);
-        InitTransferCacheMaxSize(index, size);
-
-        size_t transferSize = _transferLists[index].Size();
-        if (transferSize >= _transferCacheMaxSize[index])
+        CentralFreeList& cls = _lists[index];
+        std::lock_guard<SpinMutex> lock(cls._transferMtx);
+        size_t count = cls._transferCount.load(std::memory_order_relaxed);
+        if (count == 0)
         {
+            start = nullptr;
+            end = nullptr;
             return 0;
         }
 
-        size_t remainCapacity = _transferCacheMaxSize[index] - transferSize;
-        size_t pushNum = std::min(n, remainCapacity);
-        for (size_t i = 0; i < pushNum; ++i)
+        TransferBatch& batch = cls._transfer[count - 1];
+        if (batch._n <= batchNum)
         {
-            void* obj = start;
-            start = NextObj(start);
-            _transferLists[index].Push(obj);
+            start = batch._start;
+            end = batch._end;
+            cls._transferCount.store(count - 1, std::memory_order_relaxed);
+            return batch._n;
         }
 
-        return pushNum;
+        start = batch._start;
+        end = start;
+        for (size_t i = 1; i < batchNum; ++i)
+        {
+            end = NextObj(end);
+        }
+        batch._start = NextObj(end);
+        batch._n -= batchNum;
+        NextObj(end) = nullptr;
+        return batchNum;
     }
 
-    void InitTransferCacheMaxSize(size_t index, size_t size)
+    // 整批放进一个空槽位, 槽位满了返回 false, 由调用方还给 span
+    bool PushRangeObjToTransferCache(size_t index, void* start, size_t n)
     {
-        if (_transferCacheMaxSize[index] != 0)
+        CentralFreeList& cls = _lists[index];
+        size_t slots = SizeClass::Info(index)._transferSlots;
+        if (cls._transferCount.load(std::memory_order_relaxed) >= slots)
         {
-            return;
+            return false; // 不加锁的预判, 满了就不必遍历链表
         }
 
-        size_t base = SizeClass::NumMoveSize(size);
-        _transferCacheMaxSize[index] = std::max(base * 4, static_cast<size_t>(2));
+        // 在锁外找到链表尾
+        void* end = start;
+        for (size_t i = 1; i < n; ++i)
+        {
+            end = NextObj(end);
+        }
+        NextObj(end) = nullptr;
+
+        std::lock_guard<SpinMutex> lock(cls._transferMtx);
+        size_t count = cls._transferCount.load(std::memory_order_relaxed);
+        if (count >= slots)
+        {
+            return false;
+        }
+        cls._transferCount.store(count + 1, std::memory_order_relaxed);
+        TransferBatch& batch = cls._transfer[count];
+        batch._start = start;
+        batch._end = end;
+        batch._n = n;
+        return true;
     }
 
-    SpanList _spanLists[NFREELIST];
-    FreeList _transferLists[NFREELIST];
-    std::mutex _transferMtx[NFREELIST];
-    size_t _transferCacheMaxSize[NFREELIST] = {0};
+    CentralFreeList _lists[NFREELIST];
+    std::atomic<size_t> _newSpanCount{0};
 
     CentralCache()
     {}
 
     CentralCache(const CentralCache&) = delete;
 
-    static CentralCache _sInst;
+    static CentralCache _sInst; // 定义在 CentralCache.cc
 
 };
-
-CentralCache CentralCache::_sInst;
@@ -1,45 +1,70 @@
 #pragma once
 
-#include <iostream>
-#include <vector>
-#include <unordered_map>
-#include <thread>
-#include <chrono> // 添加chrono头文件
-#include <mutex>  // 添加mutex头文件
-#include <time.h>
+// 所有层共用的定义, 会被对外的 ConcurrentAlloc.hpp 间接包含, 只放轻量的头文件;
+// 锁, 容器等只在慢路径使用的依赖由各层自己的头文件包含
 #include <assert.h>
 #include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
 #ifdef _WIN32
+#include <windows.h>
 #include <process.h>
 #else
+#include <sys/mman.h>
 #include <unistd.h>
 #endif
 
-#include <sstream> // 添加 ostringstream 的头文件
-#ifdef _WIN32
-#include <windows.h> // 添加 Windows API 头文件，用于 GetCurrentThreadId()
+// 分支预测提示: 快路径上的判断按 likely 排布, 让命中时顺序执行不跳转;
+// 慢路径标为 noinline, 不把快路径所在的函数撑大
+#if defined(__GNUC__)
+#define CMP_LIKELY(x) __builtin_expect(!!(x), 1)
+#define CMP_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#define CMP_NOINLINE __attribute__((noinline))
+#else
+#define CMP_LIKELY(x) (x)
+#define CMP_UNLIKELY(x) (x)
+#define CMP_NOINLINE
 #endif
 
-#ifdef _WIN32
-#include <windows.h>
+// 弹出自由链表头时预取新的链表头: 下一次分配要读它的 next 指针, 使用方随后还会写它.
+// 早先释放、已被挤出缓存的对象在下一次分配时不再是一次完整的缓存缺失.
+// 预取不会触发缺页或访问异常, 链表尾的 nullptr 也可以直接传入. -DCMP_NO_PREFETCH=1 可关闭, 用于对比
+#if defined(__GNUC__) && !(defined(CMP_NO_PREFETCH) && CMP_NO_PREFETCH)
+#define CMP_PREFETCH(ptr) __builtin_prefetch((ptr), 1, 3)
 #else
-#include <sys/mman.h>
-#include <unistd.h>
+#define CMP_PREFETCH(ptr) ((void)0)
 #endif
 
-// 获取线程ID的跨平台函数
-inline std::string get_thread_id_str()
-{
-    std::ostringstream oss;
+// 线程缓存指针的 TLS 声明. 不用 thread_local: extern 的 thread_local 变量每次访问都要经过
+// 编译器生成的初始化包装函数; initial-exec 模型访问只需一次相对线程指针的寻址, 不经过 __tls_get_addr,
+// 代价是 libcmp.so 只能随程序启动加载, 进程运行中 dlopen 时可能因静态 TLS 空间不足而失败
 #ifdef _WIN32
-    // Windows下获取线程ID
-    oss << GetCurrentThreadId();
+#define CMP_TLS __declspec(thread)
 #else
-    // Linux/Unix下获取线程ID
-    oss << std::this_thread::get_id();
+#define CMP_TLS __thread __attribute__((tls_model("initial-exec")))
+#endif
+
+// 单例定义在库的 .cc 里, 提前构造, 使用方的全局对象构造时也可以分配
+#if defined(__GNUC__) && !defined(_WIN32)
+#define CMP_INIT_PRIORITY __attribute__((init_priority(101)))
+#else
+#define CMP_INIT_PRIORITY
+#endif
+
+// CMP_HARDENED=1: 面向灰度机器的加固模式 (见 Hardened.hpp). 自由链表里的指针经过混淆;
+// 每个 span 为对象记录分配状态, 以此检测重复释放; 释放时核对 span 记录的尺寸类.
+// 库与使用方需用相同的 CMP_DEFS 编译
+#ifndef CMP_HARDENED
+#define CMP_HARDENED 0
+#endif
+
+// CMP_GUARDED_SAMPLING=1: 抽样把少量对象放到保护页旁边, 用于在线上捕获越界和 use-after-free (见 GuardedPool.hpp)
+#ifndef CMP_GUARDED_SAMPLING
+#define CMP_GUARDED_SAMPLING 0
 #endif
-    return oss.str();
-}
 
 // 定义PAGE_ID类型
 #ifdef _WIN64
@@ -52,36 +77,154 @@ typedef unsigned long long PAGE_ID;
 typedef size_t PAGE_ID;
 #endif
 
-using std::cout;
-using std::endl;
-
 static const size_t MAX_BYTES = 256 * 1024;
 static const size_t THREAD_CACHE_MAX_BYTES = 64 * 1024;
 static const size_t NFREELIST = 208;
 static const size_t NPAGES = 129;
 static const size_t PAGE_SHIFT = 13;
+static_assert(NFREELIST <= 256, "SizeClass::_classArray stores free list indexes as uint8_t");
 
-inline static void *SystemAlloc(size_t kpage)
+// 通过 SystemAlloc 向系统申请、尚未用 SystemFree 归还的字节数, 供基准测试统计内存占用
+inline std::atomic<size_t> &SystemAllocBytes()
+{
+    static std::atomic<size_t> bytes(0);
+    return bytes;
+}
+
+// 向系统申请 kpage 页, 失败返回 nullptr. populate 时 (Linux 的 MAP_POPULATE) 映射时就建好页表并分配物理页,
+// 之后首次访问不再缺页; 其他平台忽略
+inline static void *SystemTryAlloc(size_t kpage, bool populate = false)
 {
 #ifdef _WIN32
-    void *ptr = VirtualAlloc(0, kpage << 13, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    (void)populate;
+    void *ptr = VirtualAlloc(0, kpage << PAGE_SHIFT, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
 #else
     // mmap 参数：起始地址，大小，权限，映射类型，文件描述符，偏移量
-    void *ptr = mmap(NULL, kpage << 13, PROT_READ | PROT_WRITE,
-                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    // mmap 只保证系统页(4K)对齐, 而页号按 1 << PAGE_SHIFT 计算, 多映射一页后裁掉首尾
+    const size_t bytes = kpage << PAGE_SHIFT;
+    const size_t align = (size_t)1 << PAGE_SHIFT;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_POPULATE
+    if (populate)
+    {
+        flags |= MAP_POPULATE;
+    }
+#endif
+    void *ptr = mmap(NULL, bytes + align, PROT_READ | PROT_WRITE, flags, -1, 0);
     if (ptr == MAP_FAILED)
     {
         ptr = nullptr;
     }
+    else
+    {
+        char *raw = (char *)ptr;
+        char *aligned = (char *)(((uintptr_t)raw + align - 1) & ~(uintptr_t)(align - 1));
+        if (aligned != raw)
+        {
+            munmap(raw, aligned - raw);
+        }
+        size_t tail = (raw + bytes + align) - (aligned + bytes);
+        if (tail > 0)
+        {
+            munmap(aligned + bytes, tail);
+        }
+        ptr = aligned;
+    }
 #endif
 
+    if (ptr != nullptr)
+    {
+        SystemAllocBytes().fetch_add(kpage << PAGE_SHIFT, std::memory_order_relaxed);
+    }
+    return ptr;
+}
+
+// 同 SystemTryAlloc, 失败抛 std::bad_alloc
+inline static void *SystemAlloc(size_t kpage)
+{
+    void *ptr = SystemTryAlloc(kpage);
     if (ptr == nullptr)
     {
         throw std::bad_alloc();
     }
-
     return ptr;
 }
+
+// 归还 SystemAlloc 申请的整块内存, ptr/kpage 必须与申请时一致
+inline static void SystemFree(void *ptr, size_t kpage)
+{
+#ifdef _WIN32
+    VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+    munmap(ptr, kpage << PAGE_SHIFT);
+#endif
+    SystemAllocBytes().fetch_sub(kpage << PAGE_SHIFT, std::memory_order_relaxed);
+}
+
+// 把一段仍然映射着的页交还系统: 物理内存立即释放, 地址保留, 之后再访问得到全零的页.
+// Windows 上暂不支持, 返回 false
+inline static bool SystemRelease(void *ptr, size_t kpage)
+{
+#ifdef _WIN32
+    (void)ptr;
+    (void)kpage;
+    return false;
+#else
+    return madvise(ptr, kpage << PAGE_SHIFT, MADV_DONTNEED) == 0;
+#endif
+}
+#if CMP_HARDENED
+// 定义在 Hardened.cc, 静态初始化最早阶段 (CMP_INIT_PRIORITY) 随机生成
+extern uintptr_t cmpFreeListSecret;
+
+// 打印出错的指针和大小后 abort, 定义在 Hardened.cc
+[[noreturn]] void HardenedFail(const char *what, const void *ptr, size_t size);
+
+// 加固模式下的 next 指针 (参考 glibc safe-linking): 存放 next ^ 密钥 ^ (所在地址 >> 12),
+// 读出时还原并检查对齐, 被越界写或 use-after-free 改写的链表在第一次读取时就会发现.
+// 用代理对象代替 void*&, NextObj(obj) = x 与 x = NextObj(obj) 的写法保持不变
+class FreeLink
+{
+public:
+    explicit FreeLink(void *obj)
+        : _slot(static_cast<uintptr_t *>(obj))
+    {}
+
+    operator void *() const
+    {
+        uintptr_t next = *_slot ^ Mask();
+        if (CMP_UNLIKELY((next & (sizeof(void *) - 1)) != 0))
+        {
+            HardenedFail("corrupted free list", _slot, 0);
+        }
+        return reinterpret_cast<void *>(next);
+    }
+
+    FreeLink &operator=(void *next)
+    {
+        *_slot = reinterpret_cast<uintptr_t>(next) ^ Mask();
+        return *this;
+    }
+
+    FreeLink &operator=(const FreeLink &other)
+    {
+        return *this = static_cast<void *>(other);
+    }
+
+private:
+    uintptr_t Mask() const
+    {
+        return cmpFreeListSecret ^ (reinterpret_cast<uintptr_t>(_slot) >> 12);
+    }
+
+    uintptr_t *_slot;
+};
+
+inline FreeLink NextObj(void *obj)
+{
+    return FreeLink(obj);
+}
+#else
 // 直接void* ojj = 0x1000，直接改变obj指向的区域，如果是*（void**）obj = 0x1000改变的是obj指向的那块区域的值
 static void *&NextObj(void *obj) // 返回void*的引用
 {
@@ -92,13 +235,14 @@ static void *&NextObj(void *obj) // 返回void*的引用
     // 4. 在自由链表中,我们需要修改next指针来维护链表关系,所以必须返回引用
     return *(void **)obj;
 }
+#endif
 
+// Push/Pop 在分配/释放的快路径上, 不做断言, 由调用方保证 obj 非空、链表非空
 class FreeList
 {
 public:
     void Push(void *obj)
     {
-        assert(obj);
         NextObj(obj) = _freeList;
         _freeList = obj;
 
@@ -109,7 +253,7 @@ public:
     {
         NextObj(end) = _freeList;
         _freeList = start;
-        _size += n;
+        _size += (uint32_t)n;
     }
 
     void PopRange(void*& start, void*& end, size_t n)
@@ -125,16 +269,24 @@ public:
 
         _freeList = NextObj(end);
         NextObj(end) = nullptr;
-        _size -= n;
+        _size -= (uint32_t)n;
+        if (_size < _lowWater)
+        {
+            _lowWater = _size;
+        }
 
     }
 
     void *Pop()
     {
-        assert(_freeList);
         void *obj = _freeList;
         _freeList = NextObj(obj);
+        CMP_PREFETCH(_freeList);
         --_size;
+        if (_size < _lowWater)
+        {
+            _lowWater = _size;
+        }
         return obj;
     }
 
@@ -143,9 +295,9 @@ public:
         return _freeList == nullptr;
     }
 
-    size_t &MaxSize()
+    void *Front()
     {
-        return _maxSize;
+        return _freeList;
     }
 
     size_t Size()
@@ -153,10 +305,38 @@ public:
         return _size;
     }
 
+    // 上次 ResetLowWater 以来链表的最短长度: 这么多对象在这段时间里一直没被用到
+    size_t LowWater()
+    {
+        return _lowWater;
+    }
+
+    void ResetLowWater()
+    {
+        _lowWater = _size;
+    }
+
 private:
+    // 只放每次分配/释放都要访问的字段, 慢开始上限等冷数据由使用方另存 (见 ThreadCache::_maxSizes)
     void *_freeList = nullptr;
-    size_t _maxSize = 1;
-    size_t _size = 0;
+    uint32_t _size = 0;
+    uint32_t _lowWater = 0;
+};
+
+// 线程缓存与中心缓存一次移动对象数的上限
+static const size_t SIZE_CLASS_MAX_BATCH = 128;
+// 每个尺寸类的转移缓存最多压着的字节数, 决定槽位数
+static const size_t SIZE_CLASS_TRANSFER_BYTES = 1024 * 1024;
+// 转移缓存槽位数的上限, 即 CentralFreeList::_transfer 的长度
+static const size_t CENTRAL_TRANSFER_SLOTS = 8;
+
+// 每个尺寸类按对象大小调好的参数 (参考 tcmalloc 的 SizeMap), 由 SizeClass::Tune 计算
+struct SizeClassInfo
+{
+    size_t _size = 0;          // 对齐后的对象大小
+    size_t _batch = 0;         // 线程缓存与中心缓存之间一次移动的对象数
+    size_t _pages = 0;         // 中心缓存每次向 PageCache 申请的 span 页数
+    size_t _transferSlots = 0; // 转移缓存可用的槽位数
 };
 
 // 计算对象大小的对齐映射规则
@@ -262,35 +442,107 @@ public:
         return -1;
     }
 
-    // 从pagecache申请的块数量，性能优化，减少锁竞争，提高效率
-    static size_t NumMoveSize(size_t size)
+    // 线程缓存范围内 (<= THREAD_CACHE_MAX_BYTES) 的尺寸类查表 (参考 tcmalloc 的 class_array):
+    // 1024 字节以内每 8 字节一格, 以上每 128 字节一格, 同一格内的大小属于同一个尺寸类.
+    // 快路径上一次移位加一次读表得到自由链表下标, 代替 RoundUp + Index 的逐级比较
+    static const size_t CLASS_ARRAY_SIZE = ((THREAD_CACHE_MAX_BYTES + 127 + (120 << 7)) >> 7) + 1;
+
+    static size_t ClassSlot(size_t bytes)
     {
-        assert(size > 0);
+        return bytes <= 1024 ? (bytes + 7) >> 3 : (bytes + 127 + (120 << 7)) >> 7;
+    }
+
+    // bytes 为 0 时与 1 字节同属第一个尺寸类
+    static size_t LookupIndex(size_t bytes)
+    {
+        return _classArray[ClassSlot(bytes)];
+    }
 
-        int num = MAX_BYTES / size;
-        if (num < 2)
-            num = 2;
+    // 填充 _classArray, 在第一个 ThreadCache 构造时调用, 早于任何快路径查表
+    static void BuildClassArray();
 
-        if (num > 512)
-            num = 512;
+    static uint8_t _classArray[CLASS_ARRAY_SIZE]; // 定义在 ThreadCache.cc
 
-        return num;
+    // 某个尺寸类的参数表项, 只在慢路径上查询
+    static const SizeClassInfo &Info(size_t index);
+
+    // 线程缓存与中心缓存之间一次移动的对象数
+    static size_t NumMoveSize(size_t size)
+    {
+        assert(size > 0);
+        return Info(Index(size))._batch;
     }
 
+    // 中心缓存为该尺寸类向 PageCache 申请的 span 页数
     static size_t NumMovePage(size_t size)
     {
-        size_t num = NumMoveSize(size);
-        size_t npage = num * size;
-        npage >>= PAGE_SHIFT;
+        assert(size > 0);
+        return Info(Index(size))._pages;
+    }
+
+    // 按对象大小计算一个尺寸类的参数:
+    // - 一批 MAX_BYTES / size 个, 限制在 [2, SIZE_CLASS_MAX_BATCH]; 小对象不再一次搬 512 个;
+    // - span 至少放得下一批 (向上取整, 不再出现 span 比一批还小的情况), 在 [p, 2p] 页里
+    //   取第一个尾部浪费不超过 1/32 的页数, 都超过时取浪费最少的;
+    // - 转移缓存槽位按每批字节数分配, 每个尺寸类最多压着 SIZE_CLASS_TRANSFER_BYTES
+    static SizeClassInfo Tune(size_t size)
+    {
+        SizeClassInfo info;
+        info._size = size;
+
+        info._batch = MAX_BYTES / size;
+        info._batch = std::max<size_t>(2, std::min(info._batch, SIZE_CLASS_MAX_BATCH));
 
-        if (npage == 0)
+        const size_t pageBytes = (size_t)1 << PAGE_SHIFT;
+        size_t minPages = (info._batch * size + pageBytes - 1) >> PAGE_SHIFT;
+        size_t maxPages = std::min(minPages * 2, NPAGES - 1);
+        size_t bestWaste = 0;
+        for (size_t pages = minPages; pages <= maxPages; ++pages)
         {
-            npage = 1;
+            size_t bytes = pages << PAGE_SHIFT;
+            size_t waste = bytes % size;
+            // waste / bytes 比较, 交叉相乘避免浮点
+            if (info._pages == 0 || waste * (info._pages << PAGE_SHIFT) < bestWaste * bytes)
+            {
+                info._pages = pages;
+                bestWaste = waste;
+            }
+            if (waste * 32 <= bytes)
+            {
+                break;
+            }
         }
-        return npage;
+
+        info._transferSlots = SIZE_CLASS_TRANSFER_BYTES / (info._batch * size);
+        info._transferSlots = std::max<size_t>(2, std::min(info._transferSlots, CENTRAL_TRANSFER_SLOTS));
+        return info;
     }
 };
 
+// 参数表在第一次查询时按 Tune 生成, 之后只读
+inline const SizeClassInfo &SizeClass::Info(size_t index)
+{
+    struct Table
+    {
+        SizeClassInfo _classes[NFREELIST];
+
+        Table()
+        {
+            for (size_t bytes = 8; bytes <= MAX_BYTES; bytes = RoundUp(bytes + 1))
+            {
+                _classes[Index(bytes)] = Tune(bytes);
+                if (bytes == MAX_BYTES)
+                {
+                    break;
+                }
+            }
+        }
+    };
+    static const Table table;
+    assert(index < NFREELIST);
+    return table._classes[index];
+}
+
 inline pid_t get_process_id()
 {
 #ifdef _WIN32
@@ -310,8 +562,22 @@ struct Span
 
     size_t _useCount = 0;
     void *_freeList = nullptr;
+    size_t _objSize = 0; // 切分的对象大小, 由 CentralCache 设置
+    size_t _capacity = 0; // 切分出的对象总数
+    size_t _bucket = 0;   // 在 CentralCache 中所处的占用率桶
 
     bool _isUse = false;
+    bool _zeroed = false; // 空闲 span 的页是否全为零 (刚由 SystemAlloc 映射, 尚未交给使用方写过)
+    bool _released = false; // 空闲 span 的物理页已由 SystemRelease 还给系统, 不计入 PageCache::HeapBytes
+
+    // 最近一次从该 span 取走对象的线程缓存, CMP_REMOTE_FREE 模式下跨线程释放据此投递
+    std::atomic<void *> _owner{nullptr};
+
+#if CMP_HARDENED
+    // 中心缓存切分的 span 上每个对象一个状态字节: 空闲/已分配/已分配且写了红区 (见 Hardened.hpp)
+    std::atomic<uint8_t> *_objStates = nullptr;
+    uint64_t _reciprocal = 0; // ceil(2^32 / _objSize), 用乘法代替除法求对象下标
+#endif
 };
 
 class SpanList
@@ -377,7 +643,4 @@ public:
 
 private:
     Span *_head;
-
-public:
-    std::mutex _mtx;
 };
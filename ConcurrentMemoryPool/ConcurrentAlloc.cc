@@ -0,0 +1,84 @@
+#include "ConcurrentAlloc.hpp"
+#include "MemoryLimit.hpp"
+#include "PageCache.hpp"
+
+// 一次分配尝试, 超过硬上限时返回 nullptr
+static void *AllocateOnce(size_t size)
+{
+    // 大对象直接向 PageCache 按页申请
+    if (size > THREAD_CACHE_MAX_BYTES)
+    {
+        return PageCache::GetInstance()->AllocateLarge(size);
+    }
+
+#if defined(CMP_SHARDED_ENGINE) && CMP_SHARDED_ENGINE
+    return ShardedAlloc(size);
+#else
+    if (pTLSThreadCache == nullptr)
+    {
+        pTLSThreadCache = CreateThreadCache();
+    }
+    return pTLSThreadCache->Allocate(size);
+#endif
+}
+
+// 失败时先处理硬上限压力再重试一次; 成功但期间触及了软上限时, 在返回前处理软上限压力
+template <class Alloc>
+static void *AllocateUnderLimits(Alloc alloc)
+{
+    void *ptr = alloc();
+    if (CMP_UNLIKELY(ptr == nullptr))
+    {
+        cmp::HandleMemoryPressure(cmp::MemoryPressure::kHard);
+        ptr = alloc();
+    }
+    else if (CMP_UNLIKELY(PageCache::GetInstance()->TakePressure()))
+    {
+        cmp::HandleMemoryPressure(cmp::MemoryPressure::kSoft);
+    }
+    return ptr;
+}
+
+void *ConcurrentAllocSlow(size_t size)
+{
+    if (size == 0)
+    {
+        size = 1;
+    }
+    return AllocateUnderLimits([size]() { return AllocateOnce(size); });
+}
+
+void ConcurrentFreeSlow(void *ptr, size_t size)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+
+    if (size == 0)
+    {
+        size = 1;
+    }
+
+    if (size > THREAD_CACHE_MAX_BYTES)
+    {
+        PageCache::GetInstance()->FreeLarge(ptr);
+        return;
+    }
+
+#if defined(CMP_SHARDED_ENGINE) && CMP_SHARDED_ENGINE
+    ShardedFree(ptr, size);
+#else
+    // 释放线程可能从未分配过 (对象由其他线程申请), 此时同样需要创建线程缓存
+    if (pTLSThreadCache == nullptr)
+    {
+        pTLSThreadCache = CreateThreadCache();
+    }
+    pTLSThreadCache->Deallocate(ptr, size);
+#endif
+}
+
+void *ConcurrentAllocLargeZeroed(size_t bytes)
+{
+    return AllocateUnderLimits([bytes]() { return PageCache::GetInstance()->AllocateLargeZeroed(bytes); });
+}
@@ -1,51 +1,138 @@
 #pragma once
 
-#include <cstdlib>
+// 对外的分配接口, 快路径在本头文件中内联; 单例、线程缓存指针和慢路径定义在库里,
+// 使用时链接 build/libcmp.a 或 build/libcmp.so (make lib), 库与使用方需用相同的 CMP_DEFS 编译.
+// 只依赖 Common.hpp 和 ThreadCache.hpp, 不会把 CentralCache/PageCache 及其依赖带进使用方
+
+#include <cstdint>
+#include <cstring>
 
 #include "Common.hpp"
+#include "Hardened.hpp"
 #include "ThreadCache.hpp"
 
-static void *ConcurrentAlloc(size_t size)
+// CMP_SHARDED_ENGINE=1: 小对象改走按页分片的 ShardedHeap 引擎
+#if defined(CMP_SHARDED_ENGINE) && CMP_SHARDED_ENGINE
+#include "ShardedHeap.hpp"
+#endif
+
+#if CMP_GUARDED_SAMPLING
+#include "GuardedPool.hpp"
+#endif
+
+#if defined(CMP_ALLOC_TRACE) && CMP_ALLOC_TRACE
+#include "AllocTrace.hpp"
+#define CMP_TRACE_RECORD(op, ptr, size) cmp::trace::Record(op, ptr, size)
+#else
+#define CMP_TRACE_RECORD(op, ptr, size) ((void)0)
+#endif
+
+// 慢路径, 定义在 ConcurrentAlloc.cc: 大对象走 PageCache, 以及线程首次分配/释放时创建线程缓存.
+// 设置了硬上限 (MemoryLimit.hpp) 时, 分配在回收一轮之后仍超限则返回 nullptr
+void *ConcurrentAllocSlow(size_t size);
+void ConcurrentFreeSlow(void *ptr, size_t size);
+void *ConcurrentAllocLargeZeroed(size_t bytes);
+
+// 快路径: 读一次 TLS 指针, 查表得到尺寸类, 自由链表非空时直接弹出; 其余情况都交给慢路径
+inline void *ConcurrentAlloc(size_t size)
 {
-    if (size == 0)
+#if CMP_GUARDED_SAMPLING
+    if (CMP_UNLIKELY(--cmpGuardedCountdown == 0))
     {
-        size = 1;
+        void *guarded = cmp::guarded::SampleAlloc(size);
+        if (guarded != nullptr)
+        {
+            CMP_TRACE_RECORD(cmp::trace::kTraceAlloc, guarded, size == 0 ? 1 : size);
+            return guarded;
+        }
     }
-
-    if (size > THREAD_CACHE_MAX_BYTES)
+#endif
+#if defined(CMP_SHARDED_ENGINE) && CMP_SHARDED_ENGINE
+    void *ptr = CMP_LIKELY(size <= THREAD_CACHE_MAX_BYTES) ? ShardedAlloc(size) : nullptr;
+    if (CMP_UNLIKELY(ptr == nullptr))
     {
-        return std::malloc(size);
+        ptr = ConcurrentAllocSlow(size);
     }
-
-    if (pTLSThreadCache == nullptr)
+#else
+    ThreadCache *cache = pTLSThreadCache;
+    void *ptr;
+    if (CMP_LIKELY(size <= THREAD_CACHE_MAX_BYTES && cache != nullptr))
     {
-        pTLSThreadCache = new ThreadCache;
+        ptr = cache->Allocate(size);
+    }
+    else
+    {
+        ptr = ConcurrentAllocSlow(size);
     }
-#if defined(CMP_ALLOC_TRACE) && CMP_ALLOC_TRACE
-    cout << "Thread ID: " << get_thread_id_str() << " ThreadCache: " << pTLSThreadCache << endl;
 #endif
-
-    return pTLSThreadCache->Allocate(size);
+    if (ptr != nullptr)
+    {
+        CMP_TRACE_RECORD(cmp::trace::kTraceAlloc, ptr, size == 0 ? 1 : size);
+#if CMP_HARDENED
+        cmp::hardened::OnAlloc(ptr, size == 0 ? 1 : size);
+#endif
+    }
+    return ptr;
 }
 
-static void ConcurrentFree(void *ptr, size_t size)
+inline void ConcurrentFree(void *ptr, size_t size)
 {
-    if (ptr == nullptr)
+    if (ptr != nullptr)
+    {
+        CMP_TRACE_RECORD(cmp::trace::kTraceFree, ptr, size == 0 ? 1 : size);
+#if CMP_GUARDED_SAMPLING
+        if (CMP_UNLIKELY(cmp::guarded::Owns(ptr)))
+        {
+            cmp::guarded::Free(ptr, size);
+            return;
+        }
+#endif
+#if CMP_HARDENED
+        cmp::hardened::OnFree(ptr, size == 0 ? 1 : size);
+#endif
+    }
+
+#if defined(CMP_SHARDED_ENGINE) && CMP_SHARDED_ENGINE
+    if (CMP_LIKELY(ptr != nullptr && size <= THREAD_CACHE_MAX_BYTES))
+    {
+        ShardedFree(ptr, size == 0 ? 1 : size);
+        return;
+    }
+#else
+    ThreadCache *cache = pTLSThreadCache;
+    if (CMP_LIKELY(ptr != nullptr && size <= THREAD_CACHE_MAX_BYTES && cache != nullptr))
     {
+        cache->Deallocate(ptr, size);
         return;
     }
+#endif
+    ConcurrentFreeSlow(ptr, size);
+}
 
-    if (size == 0)
+// 申请 n 个 size 字节的对象并清零, 用 ConcurrentFree(ptr, n * size) 释放; n * size 溢出时返回 nullptr.
+// 大对象取到的 span 仍是系统刚映射的零页时不再 memset
+inline void *ConcurrentCalloc(size_t n, size_t size)
+{
+    if (size != 0 && n > SIZE_MAX / size)
     {
-        size = 1;
+        return nullptr;
     }
 
-    if (size > THREAD_CACHE_MAX_BYTES)
+    size_t bytes = n * size;
+    if (bytes > THREAD_CACHE_MAX_BYTES)
     {
-        std::free(ptr);
-        return;
+        void *ptr = ConcurrentAllocLargeZeroed(bytes);
+        if (ptr != nullptr)
+        {
+            CMP_TRACE_RECORD(cmp::trace::kTraceAlloc, ptr, bytes);
+        }
+        return ptr;
     }
 
-    assert(pTLSThreadCache);
-    pTLSThreadCache->Deallocate(ptr, size);
+    void *ptr = ConcurrentAlloc(bytes);
+    if (ptr != nullptr)
+    {
+        memset(ptr, 0, bytes);
+    }
+    return ptr;
 }
@@ -0,0 +1,443 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "Common.hpp"
+
+namespace cmp
+{
+// 线程安全的定长对象池, 每种 T 一个全局实例.
+// 每个线程持有两个 magazine (loaded/previous, 各存放 MagazineSize 个空闲对象),
+// 绝大多数 New/Delete 只操作本线程的 magazine; 两个都空/都满时才与全局 depot
+// 整批交换, depot 是无锁栈. 只有 depot 也没有对象时才加锁从大块内存中切分.
+template <class T, size_t MagazineSize = 64>
+class ConcurrentObjectPool
+{
+public:
+    struct Deleter
+    {
+        void operator()(T *obj) const
+        {
+            ConcurrentObjectPool::GetInstance()->Delete(obj);
+        }
+    };
+
+    typedef std::unique_ptr<T, Deleter> UniquePtr;
+
+    static ConcurrentObjectPool *GetInstance()
+    {
+        static ConcurrentObjectPool inst;
+        return &inst;
+    }
+
+    template <class... Args>
+    T *New(Args &&...args)
+    {
+        void *slot = AllocateSlot();
+        try
+        {
+            // 定位new, 把参数转发给T的构造函数
+            return new (slot) T(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            FreeSlot(slot);
+            throw;
+        }
+    }
+
+    void Delete(T *obj)
+    {
+        if (obj == nullptr)
+        {
+            return;
+        }
+
+        obj->~T();
+        FreeSlot(obj);
+    }
+
+    template <class... Args>
+    UniquePtr MakeUnique(Args &&...args)
+    {
+        return UniquePtr(New(std::forward<Args>(args)...));
+    }
+
+    // 把当前线程 magazine 中的空闲对象交还 depot, 线程长期空闲前或 Trim 前调用
+    void FlushThreadMagazines()
+    {
+        LocalMagazines().Flush(this);
+    }
+
+    // 归还完全空闲的大块内存 (其对象全部位于 depot 中), 返回归还的字节数.
+    // 各线程 magazine 里的对象不参与统计, 需要时先在那些线程调用 FlushThreadMagazines.
+    size_t Trim()
+    {
+        std::lock_guard<std::mutex> lock(_chunkMtx);
+
+        std::vector<Magazine *> full;
+        while (Magazine *mag = _full.Pop())
+        {
+            full.push_back(mag);
+        }
+
+        std::vector<size_t> freeCount(_chunks.size(), 0);
+        for (size_t i = 0; i < full.size(); ++i)
+        {
+            for (size_t j = 0; j < full[i]->count; ++j)
+            {
+                freeCount[FindChunk(full[i]->objs[j])]++;
+            }
+        }
+
+        std::vector<bool> release(_chunks.size(), false);
+        size_t releasedBytes = 0;
+        for (size_t i = 0; i < _chunks.size(); ++i)
+        {
+            if (_chunks[i].carved > 0 && freeCount[i] == _chunks[i].carved)
+            {
+                release[i] = true;
+                releasedBytes += _chunks[i].pages << PAGE_SHIFT;
+            }
+        }
+
+        // 剩余对象重新装回 magazine, 装满的放回 depot
+        Magazine *cur = nullptr;
+        for (size_t i = 0; i < full.size(); ++i)
+        {
+            Magazine *mag = full[i];
+            for (size_t j = 0; j < mag->count; ++j)
+            {
+                void *obj = mag->objs[j];
+                if (release[FindChunk(obj)])
+                {
+                    continue;
+                }
+                if (cur == nullptr)
+                {
+                    cur = GetEmptyMagazine();
+                }
+                cur->objs[cur->count++] = obj;
+                if (cur->count == MagazineSize)
+                {
+                    _full.Push(cur);
+                    cur = nullptr;
+                }
+            }
+            mag->count = 0;
+            _empty.Push(mag);
+        }
+        if (cur != nullptr)
+        {
+            _full.Push(cur);
+        }
+
+        std::vector<Chunk> kept;
+        for (size_t i = 0; i < _chunks.size(); ++i)
+        {
+            if (!release[i])
+            {
+                kept.push_back(_chunks[i]);
+                continue;
+            }
+            if (_chunks[i].base == _chunkBase)
+            {
+                _cursor = nullptr;
+                _remainBytes = 0;
+                _chunkBase = nullptr;
+            }
+            SystemFree(_chunks[i].base, _chunks[i].pages);
+        }
+        _chunks.swap(kept);
+        return releasedBytes;
+    }
+
+    // 当前持有的大块内存字节数
+    size_t ChunkBytes()
+    {
+        std::lock_guard<std::mutex> lock(_chunkMtx);
+        size_t bytes = 0;
+        for (size_t i = 0; i < _chunks.size(); ++i)
+        {
+            bytes += _chunks[i].pages << PAGE_SHIFT;
+        }
+        return bytes;
+    }
+
+private:
+    struct Magazine
+    {
+        std::atomic<Magazine *> next{nullptr};
+        size_t count = 0;
+        void *objs[MagazineSize];
+    };
+
+    // 无锁栈 (Treiber stack). 头指针与版本号打包进一个64位字避免 ABA;
+    // magazine 一经创建永不释放, 所以 Pop 中读取 next 总是安全的.
+    class MagazineStack
+    {
+    public:
+        void Push(Magazine *mag)
+        {
+            uint64_t old = _head.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                mag->next.store(Unpack(old), std::memory_order_relaxed);
+                if (_head.compare_exchange_weak(old, Pack(mag, Tag(old) + 1),
+                                                std::memory_order_release, std::memory_order_relaxed))
+                {
+                    return;
+                }
+            }
+        }
+
+        Magazine *Pop()
+        {
+            uint64_t old = _head.load(std::memory_order_acquire);
+            for (;;)
+            {
+                Magazine *mag = Unpack(old);
+                if (mag == nullptr)
+                {
+                    return nullptr;
+                }
+                Magazine *next = mag->next.load(std::memory_order_relaxed);
+                if (_head.compare_exchange_weak(old, Pack(next, Tag(old) + 1),
+                                                std::memory_order_acquire, std::memory_order_acquire))
+                {
+                    return mag;
+                }
+            }
+        }
+
+    private:
+        // 64位平台用户态地址不超过48位, 高16位存版本号; 32位平台高32位存版本号
+        static const unsigned kPtrBits = sizeof(void *) == 8 ? 48 : 32;
+        static const uint64_t kPtrMask = (static_cast<uint64_t>(1) << kPtrBits) - 1;
+
+        static uint64_t Pack(Magazine *mag, uint64_t tag)
+        {
+            return (static_cast<uint64_t>(reinterpret_cast<uintptr_t>(mag)) & kPtrMask) | (tag << kPtrBits);
+        }
+
+        static Magazine *Unpack(uint64_t v)
+        {
+            return reinterpret_cast<Magazine *>(static_cast<uintptr_t>(v & kPtrMask));
+        }
+
+        static uint64_t Tag(uint64_t v)
+        {
+            return v >> kPtrBits;
+        }
+
+        std::atomic<uint64_t> _head{0};
+    };
+
+    class ThreadMagazines
+    {
+    public:
+        ~ThreadMagazines()
+        {
+            Flush(ConcurrentObjectPool::GetInstance());
+        }
+
+        void Flush(ConcurrentObjectPool *pool)
+        {
+            pool->ReturnMagazine(_loaded);
+            pool->ReturnMagazine(_previous);
+            _loaded = nullptr;
+            _previous = nullptr;
+        }
+
+        Magazine *_loaded = nullptr;
+        Magazine *_previous = nullptr;
+    };
+
+    struct Chunk
+    {
+        char *base;
+        size_t pages;
+        size_t carved; // 已切分出去的对象数
+    };
+
+    static const size_t kSlotAlign = alignof(T) > sizeof(void *) ? alignof(T) : sizeof(void *);
+    static const size_t kSlotSize = (sizeof(T) + kSlotAlign - 1) / kSlotAlign * kSlotAlign;
+    static const size_t kChunkBytes = 128 * 1024;
+
+    ConcurrentObjectPool()
+    {
+    }
+
+    ConcurrentObjectPool(const ConcurrentObjectPool &) = delete;
+
+    static ThreadMagazines &LocalMagazines()
+    {
+        static thread_local ThreadMagazines magazines;
+        return magazines;
+    }
+
+    void *AllocateSlot()
+    {
+        ThreadMagazines &tm = LocalMagazines();
+        if (tm._loaded != nullptr && tm._loaded->count > 0)
+        {
+            return tm._loaded->objs[--tm._loaded->count];
+        }
+
+        if (tm._previous != nullptr && tm._previous->count > 0)
+        {
+            std::swap(tm._loaded, tm._previous);
+            return tm._loaded->objs[--tm._loaded->count];
+        }
+
+        // 两个 magazine 都空了: 从 depot 换一个满的回来
+        Magazine *full = _full.Pop();
+        if (full != nullptr)
+        {
+            if (tm._previous != nullptr)
+            {
+                _empty.Push(tm._previous);
+            }
+            tm._previous = tm._loaded;
+            tm._loaded = full;
+            return tm._loaded->objs[--tm._loaded->count];
+        }
+
+        if (tm._loaded == nullptr)
+        {
+            tm._loaded = GetEmptyMagazine();
+        }
+        Refill(tm._loaded);
+        return tm._loaded->objs[--tm._loaded->count];
+    }
+
+    void FreeSlot(void *slot)
+    {
+        ThreadMagazines &tm = LocalMagazines();
+        if (tm._loaded != nullptr && tm._loaded->count < MagazineSize)
+        {
+            tm._loaded->objs[tm._loaded->count++] = slot;
+            return;
+        }
+
+        if (tm._previous != nullptr && tm._previous->count < MagazineSize)
+        {
+            std::swap(tm._loaded, tm._previous);
+            tm._loaded->objs[tm._loaded->count++] = slot;
+            return;
+        }
+
+        // 两个 magazine 都满了: 把一个满的交给 depot, 换一个空的
+        if (tm._previous != nullptr)
+        {
+            _full.Push(tm._previous);
+        }
+        tm._previous = tm._loaded;
+        tm._loaded = GetEmptyMagazine();
+        tm._loaded->objs[tm._loaded->count++] = slot;
+    }
+
+    Magazine *GetEmptyMagazine()
+    {
+        Magazine *mag = _empty.Pop();
+        if (mag == nullptr)
+        {
+            mag = new Magazine;
+        }
+        mag->count = 0;
+        return mag;
+    }
+
+    void ReturnMagazine(Magazine *mag)
+    {
+        if (mag == nullptr)
+        {
+            return;
+        }
+        if (mag->count > 0)
+        {
+            _full.Push(mag);
+        }
+        else
+        {
+            _empty.Push(mag);
+        }
+    }
+
+    // 从大块内存中切出一整个 magazine 的对象
+    void Refill(Magazine *mag)
+    {
+        std::lock_guard<std::mutex> lock(_chunkMtx);
+        size_t index = _chunkBase != nullptr ? FindChunk(_chunkBase) : 0;
+        while (mag->count < MagazineSize)
+        {
+            if (_remainBytes < kSlotSize)
+            {
+                size_t bytes = kChunkBytes > kSlotSize ? kChunkBytes : kSlotSize;
+                size_t pages = (bytes + (1 << PAGE_SHIFT) - 1) >> PAGE_SHIFT;
+                _chunkBase = static_cast<char *>(SystemAlloc(pages));
+                _cursor = _chunkBase;
+                _remainBytes = pages << PAGE_SHIFT;
+
+                Chunk chunk = {_chunkBase, pages, 0};
+                typename std::vector<Chunk>::iterator pos = _chunks.begin();
+                while (pos != _chunks.end() && pos->base < chunk.base)
+                {
+                    ++pos;
+                }
+                index = pos - _chunks.begin();
+                _chunks.insert(pos, chunk);
+            }
+
+            mag->objs[mag->count++] = _cursor;
+            _cursor += kSlotSize;
+            _remainBytes -= kSlotSize;
+            _chunks[index].carved++;
+        }
+    }
+
+    // _chunks 按起始地址有序, 二分查找对象所在的块; 调用方持有 _chunkMtx
+    size_t FindChunk(void *obj)
+    {
+        char *p = static_cast<char *>(obj);
+        size_t lo = 0;
+        size_t hi = _chunks.size();
+        while (hi - lo > 1)
+        {
+            size_t mid = (lo + hi) / 2;
+            if (_chunks[mid].base <= p)
+            {
+                lo = mid;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        assert(p >= _chunks[lo].base && p < _chunks[lo].base + (_chunks[lo].pages << PAGE_SHIFT));
+        return lo;
+    }
+
+    MagazineStack _full;  // 装有空闲对象的 magazine
+    MagazineStack _empty; // 空 magazine, 循环使用
+
+    std::mutex _chunkMtx;
+    std::vector<Chunk> _chunks;
+    char *_chunkBase = nullptr; // 正在切分的块
+    char *_cursor = nullptr;
+    size_t _remainBytes = 0;
+};
+
+template <class T, class... Args>
+inline typename ConcurrentObjectPool<T>::UniquePtr MakePooled(Args &&...args)
+{
+    return ConcurrentObjectPool<T>::GetInstance()->MakeUnique(std::forward<Args>(args)...);
+}
+
+} // namespace cmp
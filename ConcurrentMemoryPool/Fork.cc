@@ -0,0 +1,44 @@
+#include "Fork.hpp"
+#include "CentralCache.hpp"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+static void PreFork()
+{
+    PressureCallbacksLockForFork();
+    ThreadCachesLockForFork();
+    ShardedHeapsLockForFork();
+    CentralCache::GetInstance()->LockForFork();
+    PageCache::GetInstance()->_pageMtx.lock();
+#if CMP_GUARDED_SAMPLING
+    GuardedPoolLockForFork();
+#endif
+}
+
+static void PostForkParent()
+{
+#if CMP_GUARDED_SAMPLING
+    GuardedPoolUnlockForFork();
+#endif
+    PageCache::GetInstance()->_pageMtx.unlock();
+    CentralCache::GetInstance()->UnlockForFork();
+    ShardedHeapsUnlockForFork();
+    ThreadCachesUnlockForFork();
+    PressureCallbacksUnlockForFork();
+}
+
+static void PostForkChild()
+{
+    // 锁都由调用 fork 的线程持有, 子进程里的这个线程可以直接释放
+    PostForkParent();
+    ThreadCachesRebuildAfterFork();
+}
+
+void InstallForkHandlers()
+{
+#ifndef _WIN32
+    pthread_atfork(PreFork, PostForkParent, PostForkChild);
+#endif
+}
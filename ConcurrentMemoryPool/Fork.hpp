@@ -0,0 +1,29 @@
+#pragma once
+
+// fork 安全: 静态初始化时用 pthread_atfork 注册处理函数 (定义在 Fork.cc).
+// fork 前按固定顺序获取内存池的全部全局锁: 压力回调登记表 -> 线程缓存登记表 -> 分片堆登记表
+// -> 各尺寸类的转移缓存锁和 span 锁 -> 页缓存锁 -> 保护页抽样区域的锁, 保证子进程复制到的数据结构处于一致状态;
+// 之后父进程原样释放. 子进程只剩调用 fork 的线程, 释放锁后再整理线程缓存登记表:
+// 其他线程 fork 时可能正在无锁的快路径上, 它们的线程缓存/分片堆里的对象在子进程中放弃 (与 tcmalloc 相同),
+// 调用 fork 的线程和已退出线程留下的孤儿缓存照常使用.
+// 处理函数在静态初始化早期注册, 因此 prefork 在使用方之后注册的 prefork 处理函数之后执行,
+// 这些处理函数里仍可以使用内存池.
+// 用户自己创建的 ConcurrentObjectPool/Arena/pmr 资源对象上的锁不在其中.
+void InstallForkHandlers();
+
+// 各模块登记表的锁, 由 Fork.cc 按上面的顺序调用
+void PressureCallbacksLockForFork();
+void PressureCallbacksUnlockForFork();
+
+void ThreadCachesLockForFork();
+void ThreadCachesUnlockForFork();
+// 子进程中调用, 此时内存池的锁都已释放
+void ThreadCachesRebuildAfterFork();
+
+// 分片堆引用它的页仍指向它, 子进程里不需要整理
+void ShardedHeapsLockForFork();
+void ShardedHeapsUnlockForFork();
+
+// CMP_GUARDED_SAMPLING 模式下的槽位锁, 持有期间不获取其他锁
+void GuardedPoolLockForFork();
+void GuardedPoolUnlockForFork();
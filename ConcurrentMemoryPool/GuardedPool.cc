@@ -0,0 +1,383 @@
+#include <chrono>
+#include <csignal>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#include "GuardedPool.hpp"
+#include "Fork.hpp"
+
+#if CMP_GUARDED_SAMPLING
+
+#include <execinfo.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+uintptr_t cmpGuardedBase = 0;
+size_t cmpGuardedBytes = 0;
+// 从 1 开始, 线程的第一次分配进入 SampleAlloc 抽取倒计数
+CMP_TLS size_t cmpGuardedCountdown = 1;
+
+namespace
+{
+static const int GUARDED_TRACE_DEPTH = 16;
+// 停止抽样时, 每隔这么多次分配重新读取一次间隔
+static const size_t GUARDED_DISABLED_RECHECK = (size_t)1 << 20;
+
+CMP_TLS bool tlsCountdownStarted = false;
+CMP_TLS uint64_t tlsSampleRng = 0;
+
+long CurrentThreadId()
+{
+#ifdef __linux__
+    return (long)syscall(SYS_gettid);
+#else
+    return (long)(uintptr_t)pthread_self();
+#endif
+}
+
+// 信号处理函数里也会调用, 不经过 stdio 的缓冲和锁
+void Print(const char *fmt, ...)
+{
+    char buf[512];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (n > 0)
+    {
+        ssize_t written = write(STDERR_FILENO, buf, std::min((size_t)n, sizeof(buf) - 1));
+        (void)written;
+    }
+}
+
+struct GuardedTrace
+{
+    void *_frames[GUARDED_TRACE_DEPTH];
+    int _depth = 0;
+    long _tid = 0;
+
+    void Capture()
+    {
+        _depth = backtrace(_frames, GUARDED_TRACE_DEPTH);
+        _tid = CurrentThreadId();
+    }
+
+    void Print(const char *what) const
+    {
+        ::Print("%s by thread %ld:\n", what, _tid);
+        backtrace_symbols_fd(_frames, _depth, STDERR_FILENO);
+    }
+};
+
+struct GuardedSlot
+{
+    uintptr_t _ptr = 0;
+    size_t _size = 0;
+    bool _inUse = false;
+    bool _freed = false; // 最近一次分配的对象已释放, 槽位上的访问是 use-after-free
+    GuardedTrace _alloc;
+    GuardedTrace _free;
+};
+
+struct sigaction prevSegvAction;
+
+void GuardedSignalHandler(int sig, siginfo_t *info, void *context);
+
+class GuardedPool
+{
+public:
+    static GuardedPool *GetInstance()
+    {
+        return &_sInst;
+    }
+
+    // 超过一个系统页或槽位用尽时返回 nullptr
+    void *Allocate(size_t size)
+    {
+        if (size > _pageSize)
+        {
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (_freeCount == 0)
+        {
+            return nullptr;
+        }
+
+        size_t index = _freeRing[_freeHead];
+        uintptr_t slotAddr = SlotAddr(index);
+        if (mprotect((void *)slotAddr, _pageSize, PROT_READ | PROT_WRITE) != 0)
+        {
+            return nullptr;
+        }
+        _freeHead = (_freeHead + 1) % GUARDED_SLOTS;
+        --_freeCount;
+        ++_inUse;
+
+        // 对象贴着槽位末尾, 对齐与同样大小的尺寸类一致 (不超过 16 字节)
+        size_t align = size <= 128 ? 8 : 16;
+        GuardedSlot &slot = _slots[index];
+        slot._ptr = slotAddr + _pageSize - ((size + align - 1) & ~(align - 1));
+        slot._size = size;
+        slot._inUse = true;
+        slot._freed = false;
+        slot._alloc.Capture();
+
+        // 第一次抽中时才安装, 使用方在启动阶段安装的处理函数可以被串联
+        if (!_handlerInstalled)
+        {
+            struct sigaction action;
+            memset(&action, 0, sizeof(action));
+            action.sa_sigaction = GuardedSignalHandler;
+            action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+            sigemptyset(&action.sa_mask);
+            sigaction(SIGSEGV, &action, &prevSegvAction);
+            _handlerInstalled = true;
+        }
+        return (void *)slot._ptr;
+    }
+
+    void Deallocate(void *ptr, size_t size)
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        size_t page = ((uintptr_t)ptr - cmpGuardedBase) / _pageSize;
+        if (page % 2 == 0)
+        {
+            FailFree("invalid free of a guard page address", ptr, size, nullptr);
+        }
+
+        size_t index = page / 2;
+        GuardedSlot &slot = _slots[index];
+        if (!slot._inUse)
+        {
+            FailFree(slot._freed ? "double free" : "invalid free", ptr, size, &slot);
+        }
+        if (slot._ptr != (uintptr_t)ptr)
+        {
+            FailFree("free of a pointer into the middle of an object", ptr, size, &slot);
+        }
+        if (slot._size != size)
+        {
+            FailFree("size passed to ConcurrentFree does not match the allocation", ptr, size, &slot);
+        }
+
+        slot._free.Capture();
+        slot._inUse = false;
+        slot._freed = true;
+        madvise((void *)SlotAddr(index), _pageSize, MADV_DONTNEED);
+        mprotect((void *)SlotAddr(index), _pageSize, PROT_NONE);
+
+        // 放到队尾, 最久未使用的槽位最先复用
+        _freeRing[(_freeHead + _freeCount) % GUARDED_SLOTS] = index;
+        ++_freeCount;
+        --_inUse;
+    }
+
+    size_t InUse()
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _inUse;
+    }
+
+    // 信号处理函数中调用, 不加锁: 进程随后就会终止
+    void ReportFault(uintptr_t addr)
+    {
+        size_t page = (addr - cmpGuardedBase) / _pageSize;
+        const GuardedSlot *slot = nullptr;
+        if (page % 2 == 1)
+        {
+            slot = &_slots[page / 2];
+            Print("\nConcurrentMemoryPool guarded: %s on address %p\n",
+                  slot->_freed ? "use-after-free" : "access to an unused guarded slot", (void *)addr);
+        }
+        else if (page > 0 && _slots[page / 2 - 1]._alloc._depth > 0)
+        {
+            // 对象贴着右侧的保护页, 碰到它的是左边槽位的对象向后越界
+            slot = &_slots[page / 2 - 1];
+            Print("\nConcurrentMemoryPool guarded: heap-buffer-overflow on address %p, %zu bytes after the object\n",
+                  (void *)addr, (size_t)(addr - (slot->_ptr + slot->_size)));
+        }
+        else if (page / 2 < GUARDED_SLOTS)
+        {
+            slot = &_slots[page / 2];
+            Print("\nConcurrentMemoryPool guarded: heap-buffer-underflow on address %p\n", (void *)addr);
+        }
+        PrintSlot(slot);
+
+        GuardedTrace fault;
+        fault.Capture();
+        fault.Print("faulting access");
+    }
+
+    std::atomic<size_t> _sampleRate{CMP_GUARDED_SAMPLE_RATE};
+    std::mutex _mtx;
+
+private:
+    GuardedPool()
+    {
+        // 只保留地址空间, 槽位分配时才改为可读写
+        _pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        size_t bytes = (2 * GUARDED_SLOTS + 1) * _pageSize;
+        void *base = mmap(nullptr, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base != MAP_FAILED)
+        {
+            cmpGuardedBase = (uintptr_t)base;
+            cmpGuardedBytes = bytes;
+            _freeCount = GUARDED_SLOTS;
+        }
+        for (size_t i = 0; i < GUARDED_SLOTS; ++i)
+        {
+            _freeRing[i] = i;
+        }
+    }
+
+    uintptr_t SlotAddr(size_t index) const
+    {
+        return cmpGuardedBase + (2 * index + 1) * _pageSize;
+    }
+
+    void PrintSlot(const GuardedSlot *slot) const
+    {
+        if (slot == nullptr || slot->_alloc._depth == 0)
+        {
+            return;
+        }
+        Print("%zu-byte object at %p, %s\n", slot->_size, (void *)slot->_ptr, slot->_inUse ? "in use" : "freed");
+        slot->_alloc.Print("allocated");
+        if (slot->_freed)
+        {
+            slot->_free.Print("freed");
+        }
+    }
+
+    [[noreturn]] void FailFree(const char *what, void *ptr, size_t size, const GuardedSlot *slot)
+    {
+        Print("\nConcurrentMemoryPool guarded: %s (ptr=%p, size=%zu)\n", what, ptr, size);
+        PrintSlot(slot);
+        GuardedTrace current;
+        current.Capture();
+        current.Print("this free");
+        abort();
+    }
+
+    size_t _pageSize = 0;
+    GuardedSlot _slots[GUARDED_SLOTS];
+    size_t _freeRing[GUARDED_SLOTS]; // 空闲槽位的环形队列
+    size_t _freeHead = 0;
+    size_t _freeCount = 0;
+    size_t _inUse = 0;
+    bool _handlerInstalled = false;
+
+    static GuardedPool _sInst;
+};
+
+GuardedPool GuardedPool::_sInst CMP_INIT_PRIORITY;
+
+void GuardedSignalHandler(int sig, siginfo_t *info, void *context)
+{
+    if (cmp::guarded::Owns(info->si_addr))
+    {
+        GuardedPool::GetInstance()->ReportFault((uintptr_t)info->si_addr);
+        // 恢复原来的处理方式后返回, 出错的指令重新执行时由它处理 (默认生成 core)
+        sigaction(SIGSEGV, &prevSegvAction, nullptr);
+        return;
+    }
+
+    // 不是保护页区域的错误, 交给原来的处理函数
+    if (prevSegvAction.sa_flags & SA_SIGINFO)
+    {
+        prevSegvAction.sa_sigaction(sig, info, context);
+    }
+    else if (prevSegvAction.sa_handler == SIG_DFL || prevSegvAction.sa_handler == SIG_IGN)
+    {
+        sigaction(SIGSEGV, &prevSegvAction, nullptr);
+    }
+    else
+    {
+        prevSegvAction.sa_handler(sig);
+    }
+}
+
+// 平均 rate 次分配抽样一次
+size_t NextCountdown(size_t rate)
+{
+    if (rate == 1)
+    {
+        return 1;
+    }
+    if (tlsSampleRng == 0)
+    {
+        tlsSampleRng = (uint64_t)(uintptr_t)&tlsSampleRng ^
+                       (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count() * 0x9e3779b97f4a7c15ull;
+        tlsSampleRng |= 1;
+    }
+    tlsSampleRng ^= tlsSampleRng << 13;
+    tlsSampleRng ^= tlsSampleRng >> 7;
+    tlsSampleRng ^= tlsSampleRng << 17;
+    return 1 + (size_t)(tlsSampleRng % (2 * rate - 1));
+}
+} // namespace
+
+namespace cmp
+{
+void SetGuardedSampleRate(size_t rate)
+{
+    GuardedPool::GetInstance()->_sampleRate.store(rate, std::memory_order_relaxed);
+    cmpGuardedCountdown = rate == 0 ? GUARDED_DISABLED_RECHECK : NextCountdown(rate);
+    tlsCountdownStarted = true;
+}
+
+size_t GetGuardedSampleRate()
+{
+    return GuardedPool::GetInstance()->_sampleRate.load(std::memory_order_relaxed);
+}
+
+size_t GuardedAllocationsInUse()
+{
+    return GuardedPool::GetInstance()->InUse();
+}
+
+namespace guarded
+{
+void *SampleAlloc(size_t size)
+{
+    size_t rate = GetGuardedSampleRate();
+    cmpGuardedCountdown = rate == 0 ? GUARDED_DISABLED_RECHECK : NextCountdown(rate);
+
+    // 线程的第一次分配只抽取倒计数
+    if (!tlsCountdownStarted)
+    {
+        tlsCountdownStarted = true;
+        return nullptr;
+    }
+    if (rate == 0)
+    {
+        return nullptr;
+    }
+    return GuardedPool::GetInstance()->Allocate(size == 0 ? 1 : size);
+}
+
+void Free(void *ptr, size_t size)
+{
+    GuardedPool::GetInstance()->Deallocate(ptr, size == 0 ? 1 : size);
+}
+} // namespace guarded
+} // namespace cmp
+
+void GuardedPoolLockForFork()
+{
+    GuardedPool::GetInstance()->_mtx.lock();
+}
+
+void GuardedPoolUnlockForFork()
+{
+    GuardedPool::GetInstance()->_mtx.unlock();
+}
+
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Common.hpp"
+
+// 抽样的保护页分配 (-DCMP_GUARDED_SAMPLING=1), 参考 GWP-ASan: 每个线程平均每 GetGuardedSampleRate()
+// 次 ConcurrentAlloc 抽中一次, 该对象改由一块单独保留的区域提供. 区域里的每个槽位占一个系统页,
+// 槽位之间隔着 PROT_NONE 的保护页, 对象贴着槽位末尾放置, 越界写立即碰到下一个保护页;
+// 释放后整个槽位改为 PROT_NONE, 并且最久未使用的槽位最先复用, 尽量延长 use-after-free 的检测窗口.
+// 访问保护页或已释放的槽位时, SIGSEGV 处理函数打印错误类型、对象地址和大小、分配和释放时的调用栈,
+// 然后交还给原来的处理函数 (默认行为是生成 core); 重复释放、释放时指针或大小不符直接打印后 abort.
+// 调用栈用 backtrace 记录, 需要链接 -rdynamic 才能看到函数名.
+// 快路径上只多一次线程私有的倒计数和一次地址范围比较; 超过一个系统页的对象和槽位用尽时照常分配.
+// 保护页区域不计入 HeapBytes. 接口定义在 GuardedPool.cc, 库与使用方需用相同的 CMP_DEFS 编译
+#if CMP_GUARDED_SAMPLING
+
+#ifdef _WIN32
+#error "CMP_GUARDED_SAMPLING requires mmap/mprotect"
+#endif
+
+// 同时存在的抽样对象数上限, 区域共占 2 * GUARDED_SLOTS + 1 个系统页的地址空间
+static const size_t GUARDED_SLOTS = 32;
+
+// 进程启动时的抽样间隔, 运行中可用 SetGuardedSampleRate 修改.
+// 每次抽样 (记录调用栈, mprotect) 约十几微秒, 按这个间隔平摊到每次分配上不到 0.2ns
+#ifndef CMP_GUARDED_SAMPLE_RATE
+#define CMP_GUARDED_SAMPLE_RATE 100000
+#endif
+
+// 定义在 GuardedPool.cc. 区域在静态初始化最早阶段保留, 之后不再改变
+extern uintptr_t cmpGuardedBase;
+extern size_t cmpGuardedBytes;
+// 距离下一次抽样还剩的分配次数, 减到 0 时进入 SampleAlloc
+extern CMP_TLS size_t cmpGuardedCountdown;
+
+namespace cmp
+{
+// 平均每 rate 次分配抽样一次, 0 表示停止抽样 (已抽中的对象照常检查).
+// 调用线程立即按新的间隔计数, 其他线程在各自下一次抽样 (停止时最多 2^20 次分配) 后生效
+void SetGuardedSampleRate(size_t rate);
+size_t GetGuardedSampleRate();
+
+// 当前由保护页区域提供、尚未释放的对象数
+size_t GuardedAllocationsInUse();
+
+namespace guarded
+{
+inline bool Owns(const void *ptr)
+{
+    return (uintptr_t)ptr - cmpGuardedBase < cmpGuardedBytes;
+}
+
+// 倒计数到 0 时调用: 重新抽取倒计数, 分配成功返回对象, 对象太大、槽位用尽或停止抽样时返回 nullptr
+void *SampleAlloc(size_t size);
+
+// ptr 属于保护页区域时由 ConcurrentFree 调用
+void Free(void *ptr, size_t size);
+} // namespace guarded
+} // namespace cmp
+
+#endif
@@ -0,0 +1,77 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+#include "Hardened.hpp"
+
+#if CMP_HARDENED
+
+uintptr_t cmpFreeListSecret = 0;
+
+#if CMP_HARDENED_REDZONE_INTERVAL
+CMP_TLS size_t cmpRedzoneCounter = 0;
+#endif
+
+void HardenedFail(const char *what, const void *ptr, size_t size)
+{
+    fprintf(stderr, "ConcurrentMemoryPool: %s (ptr=%p, size=%zu)\n", what, ptr, size);
+    abort();
+}
+
+namespace
+{
+// random_device 不可用时退回 ASLR 下的地址和时钟
+uintptr_t MakeSecret()
+{
+    uint64_t secret = 0;
+    try
+    {
+        std::random_device rd;
+        secret = ((uint64_t)rd() << 32) ^ rd();
+    }
+    catch (...)
+    {
+    }
+    secret ^= (uint64_t)(uintptr_t)&secret;
+    secret ^= (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count() * 0x9e3779b97f4a7c15ull;
+    return (uintptr_t)secret;
+}
+
+// 必须早于任何分配: 与单例同在最早的初始化优先级, 单例的构造函数不分配
+struct SecretInit
+{
+    SecretInit()
+    {
+        cmpFreeListSecret = MakeSecret();
+    }
+};
+
+SecretInit secretInit CMP_INIT_PRIORITY;
+} // namespace
+
+namespace cmp
+{
+namespace hardened
+{
+void AttachStates(Span *span)
+{
+    // 对象起始处 offset = k * size < 2^32, 取 ceil(2^32 / size) 时 (offset * r) >> 32 恰为 k
+    span->_reciprocal = (((uint64_t)1 << 32) + span->_objSize - 1) / span->_objSize;
+    span->_objStates = new std::atomic<uint8_t>[span->_capacity];
+    for (size_t i = 0; i < span->_capacity; ++i)
+    {
+        span->_objStates[i].store(kObjFree, std::memory_order_relaxed);
+    }
+}
+
+void DetachStates(Span *span)
+{
+    delete[] span->_objStates;
+    span->_objStates = nullptr;
+}
+} // namespace hardened
+} // namespace cmp
+
+#endif
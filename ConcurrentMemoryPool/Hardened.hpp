@@ -0,0 +1,136 @@
+#pragma once
+
+#include "Common.hpp"
+
+// 加固模式 (-DCMP_HARDENED=1), 参考 scudo / tcmalloc 的检查, 目标是在灰度机器上以较小的代价
+// 把内存错误变成立即的 abort, 而不是悄悄破坏其他尺寸类的自由链表:
+// - 自由链表指针混淆 (见 Common.hpp 的 FreeLink);
+// - 中心缓存切分 span 时附带每个对象一个状态字节, 对象交给使用方时标为已分配, 释放时标回空闲,
+//   释放时已是空闲即重复释放. 同一个对象同一时刻只属于一个线程, 读写状态不需要加锁的原子操作;
+// - ConcurrentFree 传入的大小与 span 记录的尺寸类不一致、指针不在对象起始处或不属于内存池时 abort;
+// - CMP_HARDENED_REDZONE_INTERVAL 非 0 时, 每个线程每这么多次小对象分配抽样一次,
+//   把请求大小到尺寸类大小之间的空隙填成红区, 释放时检查是否被越界写过.
+// 只检查经过 ConcurrentAlloc/ConcurrentFree 的对象; 分片引擎不支持.
+// 检查在快路径上内联, 只有出错时才调用 HardenedFail
+#if CMP_HARDENED
+
+#if defined(CMP_SHARDED_ENGINE) && CMP_SHARDED_ENGINE
+#error "CMP_HARDENED does not support CMP_SHARDED_ENGINE"
+#endif
+
+#ifndef CMP_HARDENED_REDZONE_INTERVAL
+#define CMP_HARDENED_REDZONE_INTERVAL 0
+#endif
+
+#include "PageCache.hpp"
+
+static const unsigned char HARDENED_REDZONE_BYTE = 0xa5;
+
+#if CMP_HARDENED_REDZONE_INTERVAL
+// 红区抽样计数, 定义在 Hardened.cc
+extern CMP_TLS size_t cmpRedzoneCounter;
+#endif
+
+namespace cmp
+{
+namespace hardened
+{
+// 对象状态, 见 Span::_objStates
+enum : uint8_t
+{
+    kObjFree = 0,
+    kObjAllocated = 1,
+    kObjRedzoned = 2 // 已分配, 且请求大小之后到对象末尾填了红区
+};
+
+// 中心缓存切分 span 后附上状态数组, span 归还 PageCache 前取下. 定义在 Hardened.cc
+void AttachStates(Span *span);
+void DetachStates(Span *span);
+
+// offset 是对象起始处时结果精确, 见 AttachStates
+inline size_t ObjectIndex(const Span *span, size_t offset)
+{
+    return (size_t)(((uint64_t)offset * span->_reciprocal) >> 32);
+}
+
+// ConcurrentAlloc 返回前调用, ptr 非空
+inline void OnAlloc(void *ptr, size_t size)
+{
+    // 大对象独占一个 span, 释放时直接核对 span
+    if (size > THREAD_CACHE_MAX_BYTES)
+    {
+        return;
+    }
+
+    Span *span = PageCache::GetInstance()->MapObjectToSpan(ptr);
+    std::atomic<uint8_t> &state = span->_objStates[ObjectIndex(span, (char *)ptr - (char *)(span->_pageID << PAGE_SHIFT))];
+    if (CMP_UNLIKELY(state.load(std::memory_order_relaxed) != kObjFree))
+    {
+        HardenedFail("object handed out twice, free list corrupted", ptr, size);
+    }
+
+#if CMP_HARDENED_REDZONE_INTERVAL
+    if (size < span->_objSize && ++cmpRedzoneCounter % CMP_HARDENED_REDZONE_INTERVAL == 0)
+    {
+        memset((char *)ptr + size, HARDENED_REDZONE_BYTE, span->_objSize - size);
+        state.store(kObjRedzoned, std::memory_order_relaxed);
+        return;
+    }
+#endif
+    state.store(kObjAllocated, std::memory_order_relaxed);
+}
+
+// ConcurrentFree 归还前调用, ptr 非空
+inline void OnFree(void *ptr, size_t size)
+{
+    Span *span = PageCache::GetInstance()->TryMapObjectToSpan(ptr);
+    if (CMP_UNLIKELY(span == nullptr || !span->_isUse))
+    {
+        HardenedFail("free of a pointer not allocated by the pool", ptr, size);
+    }
+
+    char *start = (char *)(span->_pageID << PAGE_SHIFT);
+    if (size > THREAD_CACHE_MAX_BYTES)
+    {
+        if (span->_objStates != nullptr || span->_objSize != size || (char *)ptr != start)
+        {
+            HardenedFail("large free does not match its allocation (wrong pointer or size)", ptr, size);
+        }
+        return;
+    }
+
+    if (CMP_UNLIKELY(span->_objStates == nullptr || span->_objSize != SizeClass::RoundUp(size)))
+    {
+        HardenedFail("size passed to ConcurrentFree does not match the object's size class", ptr, size);
+    }
+
+    size_t offset = (char *)ptr - start;
+    size_t index = ObjectIndex(span, offset);
+    if (CMP_UNLIKELY(index * span->_objSize != offset))
+    {
+        HardenedFail("free of a pointer into the middle of an object", ptr, size);
+    }
+
+    std::atomic<uint8_t> &state = span->_objStates[index];
+    uint8_t old = state.load(std::memory_order_relaxed);
+    if (CMP_UNLIKELY(old == kObjFree))
+    {
+        HardenedFail("double free", ptr, size);
+    }
+    state.store(kObjFree, std::memory_order_relaxed);
+
+    if (CMP_UNLIKELY(old == kObjRedzoned))
+    {
+        for (size_t i = size; i < span->_objSize; ++i)
+        {
+            if ((unsigned char)((char *)ptr)[i] != HARDENED_REDZONE_BYTE)
+            {
+                HardenedFail("heap buffer overflow into the redzone", ptr, size);
+            }
+        }
+    }
+}
+} // namespace hardened
+} // namespace cmp
+
+#endif
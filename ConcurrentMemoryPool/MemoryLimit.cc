@@ -0,0 +1,226 @@
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "MemoryLimit.hpp"
+#include "CentralCache.hpp"
+#include "Fork.hpp"
+#include "ShardedHeap.hpp"
+#include "ThreadCache.hpp"
+
+namespace cmp
+{
+namespace
+{
+struct PressureCallbackEntry
+{
+    int _id;
+    MemoryPressureCallback _callback;
+    void *_arg;
+};
+
+class PressureCallbacks
+{
+public:
+    static PressureCallbacks *GetInstance()
+    {
+        static PressureCallbacks inst;
+        return &inst;
+    }
+
+    int Add(MemoryPressureCallback callback, void *arg)
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        PressureCallbackEntry entry = {++_nextId, callback, arg};
+        _entries.push_back(entry);
+        return entry._id;
+    }
+
+    void Remove(int id)
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        for (size_t i = 0; i < _entries.size(); ++i)
+        {
+            if (_entries[i]._id == id)
+            {
+                _entries.erase(_entries.begin() + i);
+                return;
+            }
+        }
+    }
+
+    // 复制一份再调用, 回调里可以注册/注销
+    void Run(MemoryPressure level)
+    {
+        std::vector<PressureCallbackEntry> entries;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            entries = _entries;
+        }
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            entries[i]._callback(level, entries[i]._arg);
+        }
+    }
+
+    std::mutex _mtx;
+
+private:
+    std::vector<PressureCallbackEntry> _entries;
+    int _nextId = 0;
+};
+
+// 回调或回收过程中再次触及上限时不重入
+CMP_TLS bool tlsHandlingPressure = false;
+
+// 清空调用线程的缓存和中心缓存, 再把空闲页还给系统直到堆占用不超过 target
+size_t ReleaseTo(size_t target)
+{
+    FlushThreadCache();
+    CentralCache::GetInstance()->ReleaseSparseSpans();
+
+    PageCache *pageCache = PageCache::GetInstance();
+    std::lock_guard<SpinMutex> lock(pageCache->_pageMtx);
+    size_t heap = pageCache->HeapBytes();
+    return heap > target ? pageCache->ReleaseFreePages(heap - target) : 0;
+}
+
+// 读取一个 memory.max, "max" 或读取失败返回 0
+size_t ReadMemoryMax(const std::string &dir)
+{
+    std::ifstream in((dir + "/memory.max").c_str());
+    std::string value;
+    if (!(in >> value) || value == "max")
+    {
+        return 0;
+    }
+    return std::strtoull(value.c_str(), nullptr, 10);
+}
+} // namespace
+
+void SetMemoryLimits(size_t softBytes, size_t hardBytes)
+{
+    PageCache::GetInstance()->SetLimits(softBytes, hardBytes);
+}
+
+size_t GetSoftMemoryLimit()
+{
+    return PageCache::GetInstance()->SoftLimit();
+}
+
+size_t GetHardMemoryLimit()
+{
+    return PageCache::GetInstance()->HardLimit();
+}
+
+size_t HeapBytes()
+{
+    return PageCache::GetInstance()->HeapBytes();
+}
+
+size_t DetectCgroupMemoryLimit()
+{
+#ifdef __linux__
+    // cgroup v2 在 /proc/self/cgroup 中只有一行 "0::<path>"
+    std::ifstream in("/proc/self/cgroup");
+    std::string line;
+    std::string path;
+    while (std::getline(in, line))
+    {
+        if (line.compare(0, 3, "0::") == 0)
+        {
+            path = line.substr(3);
+            break;
+        }
+    }
+    if (path.empty())
+    {
+        return 0;
+    }
+
+    // 祖先的限制同样生效, 逐级向上取最小值; 根 cgroup 没有 memory.max
+    size_t limit = 0;
+    while (!path.empty() && path != "/")
+    {
+        size_t max = ReadMemoryMax("/sys/fs/cgroup" + path);
+        if (max != 0 && (limit == 0 || max < limit))
+        {
+            limit = max;
+        }
+        path = path.substr(0, path.find_last_of('/'));
+    }
+    return limit;
+#else
+    return 0;
+#endif
+}
+
+size_t ApplyCgroupMemoryLimit(double softRatio, double hardRatio)
+{
+    size_t limit = DetectCgroupMemoryLimit();
+    if (limit != 0)
+    {
+        SetMemoryLimits((size_t)(limit * softRatio), (size_t)(limit * hardRatio));
+    }
+    return limit;
+}
+
+int AddMemoryPressureCallback(MemoryPressureCallback callback, void *arg)
+{
+    return PressureCallbacks::GetInstance()->Add(callback, arg);
+}
+
+void RemoveMemoryPressureCallback(int id)
+{
+    PressureCallbacks::GetInstance()->Remove(id);
+}
+
+void FlushThreadCache()
+{
+    if (pTLSThreadCache != nullptr)
+    {
+        pTLSThreadCache->ReleaseAll();
+    }
+    if (pTLSShardedHeap != nullptr)
+    {
+        pTLSShardedHeap->Collect();
+    }
+}
+
+size_t ReleaseFreeMemory()
+{
+    return ReleaseTo(0);
+}
+
+size_t TrimTo(size_t bytes)
+{
+    ReleaseTo(bytes);
+    return HeapBytes();
+}
+
+void HandleMemoryPressure(MemoryPressure level)
+{
+    if (tlsHandlingPressure)
+    {
+        return;
+    }
+    tlsHandlingPressure = true;
+
+    PressureCallbacks::GetInstance()->Run(level);
+    ReleaseTo(0);
+
+    tlsHandlingPressure = false;
+}
+} // namespace cmp
+
+void PressureCallbacksLockForFork()
+{
+    cmp::PressureCallbacks::GetInstance()->_mtx.lock();
+}
+
+void PressureCallbacksUnlockForFork()
+{
+    cmp::PressureCallbacks::GetInstance()->_mtx.unlock();
+}
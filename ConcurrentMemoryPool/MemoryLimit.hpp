@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+
+// 内存上限 (参考 tcmalloc 的 soft/hard limit), 按堆占用计算: PageCache 向系统映射的字节数减去已还给系统的空闲页.
+// 只在 PageCache 需要向系统申请新内存时检查, 复用已缓存的空闲 span 不受影响:
+// - 软上限: 先把空闲 span 的物理页还给系统 (madvise), 仍然允许增长; 同时登记一次压力事件,
+//   分配线程在返回前调用压力回调并回收中心缓存, 其他线程的缓存在各自下一次慢路径上全部还回;
+// - 硬上限: 同样先释放空闲页, 仍超限则拒绝增长. 分配线程处理一轮压力 (回调、清空缓存、回收) 后
+//   重试一次, 再失败时 ConcurrentAlloc/ConcurrentCalloc 返回 nullptr,
+//   分配器适配层 (AllocatorWrapper/Arena/MemoryResource) 抛出 std::bad_alloc.
+// 上限为 0 表示不限制, 默认都为 0.
+// 另外提供主动归还的接口 (FlushThreadCache/ReleaseFreeMemory/TrimTo), 供批处理任务在阶段之间释放内存.
+// 接口定义在 MemoryLimit.cc.
+namespace cmp
+{
+enum class MemoryPressure
+{
+    kSoft,
+    kHard
+};
+
+// 在触及上限的分配线程上调用, 此时不持有内存池的任何锁, 回调里可以释放内存;
+// 回调里再分配触及上限时不会重复进入回调
+typedef void (*MemoryPressureCallback)(MemoryPressure level, void *arg);
+
+void SetMemoryLimits(size_t softBytes, size_t hardBytes);
+size_t GetSoftMemoryLimit();
+size_t GetHardMemoryLimit();
+
+// 当前堆占用, 与上限比较的就是这个值
+size_t HeapBytes();
+
+// 读取当前进程所在 cgroup v2 及其祖先的 memory.max, 取最小值; 不受限制或无法读取时返回 0
+size_t DetectCgroupMemoryLimit();
+
+// 按 cgroup 的 memory.max 设置上限: 软上限为其 softRatio, 硬上限为其 hardRatio.
+// 返回检测到的 memory.max, 为 0 时不修改当前上限
+size_t ApplyCgroupMemoryLimit(double softRatio = 0.75, double hardRatio = 0.9);
+
+// 返回注册 id, 用于注销
+int AddMemoryPressureCallback(MemoryPressureCallback callback, void *arg);
+void RemoveMemoryPressureCallback(int id);
+
+// 把调用线程缓存的对象全部还给 CentralCache (分片引擎下收回远程释放并归还空页).
+// 只影响调用线程, 各工作线程需要在阶段结束时各自调用
+void FlushThreadCache();
+
+// 清空中心缓存的转移缓存, 变空的 span 归还 PageCache, 再把 PageCache 的空闲页全部还给系统.
+// 返回本次还给系统的字节数
+size_t ReleaseFreeMemory();
+
+// 同 FlushThreadCache + ReleaseFreeMemory, 但只释放到堆占用不超过 bytes 为止 (仍在使用的页无法释放).
+// 返回之后的堆占用
+size_t TrimTo(size_t bytes);
+
+// 分配慢路径内部调用: 依次执行回调, 把本线程缓存全部还回, 回收中心缓存的稀疏 span,
+// 再把空闲页还给系统. 也可以由使用方在收到外部内存压力信号时主动调用
+void HandleMemoryPressure(MemoryPressure level);
+} // namespace cmp
@@ -0,0 +1,314 @@
+#pragma once
+
+// std::pmr 适配层, 需要 C++17 (make pmr-demo)
+#if __cplusplus < 201703L
+#error "MemoryResource.hpp requires C++17 (std::pmr)"
+#endif
+
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+
+#include "Arena.hpp"
+#include "CentralCache.hpp"
+#include "ConcurrentAlloc.hpp"
+
+namespace cmp
+{
+// 在对齐要求 align 下为 bytes 选择尺寸类: 返回的尺寸是 align 的整数倍.
+// span 起始地址按页对齐, 对象以尺寸为步长切分, 所以对象地址也满足 align
+inline size_t AlignedClassSize(size_t bytes, size_t align)
+{
+    if (bytes == 0)
+    {
+        bytes = 1;
+    }
+    size_t size = SizeClass::RoundUp((bytes + align - 1) & ~(align - 1));
+    while (size % align != 0)
+    {
+        size = SizeClass::RoundUp(size + 1);
+    }
+    return size;
+}
+
+// 全局内存池: 小对象走 ConcurrentAlloc, 超出线程缓存或页对齐的请求交给 ::operator new
+class pool_resource : public std::pmr::memory_resource
+{
+protected:
+    void *do_allocate(size_t bytes, size_t align) override
+    {
+        if (!UsePool(bytes, align))
+        {
+            return ::operator new(bytes, std::align_val_t(align));
+        }
+        void *ptr = ConcurrentAlloc(AlignedClassSize(bytes, align));
+        if (ptr == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    void do_deallocate(void *ptr, size_t bytes, size_t align) override
+    {
+        if (!UsePool(bytes, align))
+        {
+            ::operator delete(ptr, bytes, std::align_val_t(align));
+            return;
+        }
+        ConcurrentFree(ptr, AlignedClassSize(bytes, align));
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return dynamic_cast<const pool_resource *>(&other) != nullptr;
+    }
+
+private:
+    static bool UsePool(size_t bytes, size_t align)
+    {
+        return align <= ((size_t)1 << PAGE_SHIFT) && bytes <= THREAD_CACHE_MAX_BYTES &&
+               AlignedClassSize(bytes, align) <= THREAD_CACHE_MAX_BYTES;
+    }
+};
+
+// 与 std::pmr::new_delete_resource() 对应的全局实例
+inline pool_resource *GetPoolResource()
+{
+    static pool_resource inst;
+    return &inst;
+}
+
+// 与 std::pmr::synchronized_pool_resource 接口一致的按尺寸类资源:
+// 每个尺寸类一个带锁的自由链表, 空了从 CentralCache 批量取, 不经过线程缓存,
+// 所以多个容器可以共用, 也可以每个容器一个, 互不影响.
+// 超过 largest_required_pool_block 的请求交给 upstream.
+// 内存在 release() 或析构时整体还给 CentralCache.
+class size_class_pool_resource : public std::pmr::memory_resource
+{
+public:
+    size_class_pool_resource()
+        : size_class_pool_resource(std::pmr::pool_options(), GetPoolResource())
+    {
+    }
+
+    explicit size_class_pool_resource(std::pmr::memory_resource *upstream)
+        : size_class_pool_resource(std::pmr::pool_options(), upstream)
+    {
+    }
+
+    explicit size_class_pool_resource(const std::pmr::pool_options &opts)
+        : size_class_pool_resource(opts, GetPoolResource())
+    {
+    }
+
+    size_class_pool_resource(const std::pmr::pool_options &opts, std::pmr::memory_resource *upstream)
+        : _upstream(upstream), _options(opts)
+    {
+        if (_options.largest_required_pool_block == 0 || _options.largest_required_pool_block > MAX_BYTES)
+        {
+            _options.largest_required_pool_block = _options.largest_required_pool_block == 0 ? THREAD_CACHE_MAX_BYTES : MAX_BYTES;
+        }
+        _options.largest_required_pool_block = SizeClass::RoundUp(_options.largest_required_pool_block);
+    }
+
+    ~size_class_pool_resource() override
+    {
+        release();
+    }
+
+    size_class_pool_resource(const size_class_pool_resource &) = delete;
+    size_class_pool_resource &operator=(const size_class_pool_resource &) = delete;
+
+    // 把各尺寸类链表上的空闲对象全部还给 CentralCache; 仍在使用的对象不受影响
+    void release()
+    {
+        for (size_t i = 0; i < NFREELIST; ++i)
+        {
+            std::lock_guard<std::mutex> lock(_pools[i]._mtx);
+            if (_pools[i]._head != nullptr)
+            {
+                CentralCache::GetInstance()->ReleaseListToSpans(_pools[i]._head, _pools[i]._size, _pools[i]._count);
+                _pools[i]._head = nullptr;
+                _pools[i]._count = 0;
+            }
+        }
+    }
+
+    std::pmr::memory_resource *upstream_resource() const
+    {
+        return _upstream;
+    }
+
+    std::pmr::pool_options options() const
+    {
+        return _options;
+    }
+
+protected:
+    void *do_allocate(size_t bytes, size_t align) override
+    {
+        if (!UsePool(bytes, align))
+        {
+            return _upstream->allocate(bytes, align);
+        }
+
+        size_t size = AlignedClassSize(bytes, align);
+        Pool &pool = _pools[SizeClass::Index(size)];
+        std::lock_guard<std::mutex> lock(pool._mtx);
+        if (pool._head == nullptr)
+        {
+            void *start = nullptr;
+            void *end = nullptr;
+            pool._count = CentralCache::GetInstance()->FetchRangeObj(start, end, BatchNum(size), size);
+            if (pool._count == 0)
+            {
+                throw std::bad_alloc();
+            }
+            pool._head = start;
+            pool._size = size;
+        }
+
+        void *obj = pool._head;
+        pool._head = NextObj(obj);
+        pool._count--;
+        return obj;
+    }
+
+    void do_deallocate(void *ptr, size_t bytes, size_t align) override
+    {
+        if (!UsePool(bytes, align))
+        {
+            _upstream->deallocate(ptr, bytes, align);
+            return;
+        }
+
+        size_t size = AlignedClassSize(bytes, align);
+        Pool &pool = _pools[SizeClass::Index(size)];
+        std::lock_guard<std::mutex> lock(pool._mtx);
+        NextObj(ptr) = pool._head;
+        pool._head = ptr;
+        pool._size = size;
+        pool._count++;
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+private:
+    struct Pool
+    {
+        std::mutex _mtx;
+        void *_head = nullptr;
+        size_t _count = 0;
+        size_t _size = 0;
+    };
+
+    bool UsePool(size_t bytes, size_t align) const
+    {
+        return align <= ((size_t)1 << PAGE_SHIFT) && bytes <= _options.largest_required_pool_block &&
+               AlignedClassSize(bytes, align) <= _options.largest_required_pool_block;
+    }
+
+    size_t BatchNum(size_t size) const
+    {
+        size_t num = SizeClass::NumMoveSize(size);
+        if (_options.max_blocks_per_chunk != 0 && num > _options.max_blocks_per_chunk)
+        {
+            num = _options.max_blocks_per_chunk;
+        }
+        return num;
+    }
+
+    std::pmr::memory_resource *_upstream;
+    std::pmr::pool_options _options;
+    Pool _pools[NFREELIST];
+};
+
+// 与 std::pmr::monotonic_buffer_resource 对应的单调资源: 从 PageCache 直接取 span 顺序切分,
+// deallocate 为空操作, release() 或析构时所有 span 一次归还.
+// 超过 NPAGES - 1 页的大请求交给 upstream, 避免浪费当前 span 的剩余空间, 同样在 release() 时统一释放.
+// 与 monotonic_buffer_resource 一样不是线程安全的.
+class monotonic_span_resource : public std::pmr::memory_resource
+{
+public:
+    explicit monotonic_span_resource(std::pmr::memory_resource *upstream = GetPoolResource(),
+                                     size_t initPages = 1, size_t maxPages = 32)
+        : _arena(initPages, maxPages), _upstream(upstream)
+    {
+    }
+
+    ~monotonic_span_resource() override
+    {
+        release();
+    }
+
+    monotonic_span_resource(const monotonic_span_resource &) = delete;
+    monotonic_span_resource &operator=(const monotonic_span_resource &) = delete;
+
+    void release()
+    {
+        while (_large != nullptr)
+        {
+            LargeBlock *block = _large;
+            _large = block->_next;
+            _upstream->deallocate(block->_ptr, block->_bytes, block->_align);
+        }
+        _arena.Reset();
+    }
+
+    std::pmr::memory_resource *upstream_resource() const
+    {
+        return _upstream;
+    }
+
+    // 便于在请求内部打回滚点
+    Arena &arena()
+    {
+        return _arena;
+    }
+
+protected:
+    void *do_allocate(size_t bytes, size_t align) override
+    {
+        if (bytes <= ((NPAGES - 1) << PAGE_SHIFT) && align <= ((size_t)1 << PAGE_SHIFT))
+        {
+            return _arena.Allocate(bytes, align);
+        }
+
+        LargeBlock *block = static_cast<LargeBlock *>(_arena.Allocate(sizeof(LargeBlock), alignof(LargeBlock)));
+        block->_ptr = _upstream->allocate(bytes, align);
+        block->_bytes = bytes;
+        block->_align = align;
+        block->_next = _large;
+        _large = block;
+        return block->_ptr;
+    }
+
+    void do_deallocate(void *, size_t, size_t) override
+    {
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+private:
+    struct LargeBlock
+    {
+        void *_ptr;
+        size_t _bytes;
+        size_t _align;
+        LargeBlock *_next;
+    };
+
+    Arena _arena;
+    LargeBlock *_large = nullptr;
+    std::pmr::memory_resource *_upstream;
+};
+
+} // namespace cmp
@@ -0,0 +1,11 @@
+#include "PageCache.hpp"
+#include "Fork.hpp"
+#include "Prewarm.hpp"
+
+PageCache PageCache::_sInst CMP_INIT_PRIORITY;
+
+// 使用内存池的程序一定会链接本目标文件, fork 处理函数在这里注册, 也就把 Fork.cc 一并链接进来
+static const bool forkHandlersInstalled = (InstallForkHandlers(), true);
+
+// 同理链接 Prewarm.cc. 默认优先级, 晚于各单例的构造 (CMP_INIT_PRIORITY)
+static const bool startupPrewarmApplied = (ApplyStartupPrewarm(), true);
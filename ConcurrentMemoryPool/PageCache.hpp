@@ -1,6 +1,25 @@
 #pragma once
 
+#include <cstring>
+#include <mutex>
+#include <set>
+
 #include "Common.hpp"
+#include "PageMap.hpp"
+#include "SpinMutex.hpp"
+
+// 大 span (>= NPAGES 页) 按 (页数, 起始页号) 排序, lower_bound 得到的就是地址最低的最佳匹配
+struct SpanBestFitLess
+{
+    bool operator()(const Span *a, const Span *b) const
+    {
+        if (a->_n != b->_n)
+        {
+            return a->_n < b->_n;
+        }
+        return a->_pageID < b->_pageID;
+    }
+};
 
 class PageCache
 {
@@ -10,74 +29,194 @@ public:
         return &_sInst;
     }
 
+    // 取 k 页的 span, k 不再受 NPAGES 限制. 调用方持有 _pageMtx.
+    // 超过硬上限或系统内存不足时返回 nullptr
     Span *NewSpan(size_t k)
     {
-        assert(k > 0 && k < NPAGES);
+        assert(k > 0);
 
-        if (!_spanLists[k].Empty())
+        Span *span = FindBestFit(k);
+        if (span == nullptr)
+        {
+            if (!Grow(k))
+            {
+                return nullptr;
+            }
+            span = FindBestFit(k);
+            assert(span != nullptr);
+        }
+        // 复用已还给系统的页同样会增加堆占用
+        if (span->_released && !WithinLimits(k << PAGE_SHIFT))
         {
-            Span *span = _spanLists[k].PopFront();
-            span->_isUse = true;
-            return span;
+            InsertFreeSpan(span);
+            return nullptr;
         }
 
-        for (size_t i = k + 1; i < NPAGES; i++)
+        // 从低地址切出 k 页, 剩余的高地址部分放回空闲索引, 让已用内存尽量集中在低地址
+        if (span->_n > k)
         {
-            if (!_spanLists[i].Empty())
-            {
-                Span *nSpan = _spanLists[i].PopFront();
-                UnMapSpan(nSpan);
-                Span *kSpan = new Span;
+            Span *rest = new Span;
+            rest->_pageID = span->_pageID + k;
+            rest->_n = span->_n - k;
+            rest->_zeroed = span->_zeroed;
+            rest->_released = span->_released;
+            span->_n = k;
+            InsertFreeSpan(rest);
+        }
+        // 交给使用方后页会被重新写入, 重新计入堆
+        if (span->_released)
+        {
+            _releasedBytes.fetch_sub(span->_n << PAGE_SHIFT, std::memory_order_relaxed);
+            span->_released = false;
+        }
 
-                kSpan->_pageID = nSpan->_pageID;
-                kSpan->_n = k;
-                kSpan->_isUse = true;
+        span->_isUse = true;
+        MapSpan(span);
+        return span;
+    }
+
+    Span* MapObjectToSpan(void *obj)
+    {
+        PAGE_ID id = ((PAGE_ID)obj >> PAGE_SHIFT); // 将obj强转为PAGE_ID, 然后右移PAGE_SHIFT位,得到页号
+        // 基数树读取不需要加锁, 见 PageMap.hpp
+        Span *span = _idSpanMap.Get(id);
+        assert(span != nullptr);
+        return span;
+    }
+
+    // 同 MapObjectToSpan, 不属于内存池的地址返回 nullptr, 供加固模式检查使用方传入的指针
+    Span *TryMapObjectToSpan(const void *obj)
+    {
+        return _idSpanMap.Get((PAGE_ID)obj >> PAGE_SHIFT);
+    }
 
-                nSpan->_pageID += k;
-                nSpan->_n -= k;
-                nSpan->_isUse = false;
+    // 使用方归还的 span 已被写过, 不再是零页
+    void ReleaseSpanToPageCache(Span* span)
+    {
+        assert(span);
+        span->_zeroed = false;
+        Coalesce(span);
+    }
 
-                MapSpan(kSpan);
-                MapSpan(nSpan);
-                _spanLists[nSpan->_n].PushFront(nSpan);
+    // 超过 THREAD_CACHE_MAX_BYTES 的对象直接按页取一个 span, 内部加锁; 超过硬上限时返回 nullptr
+    void *AllocateLarge(size_t size)
+    {
+        size_t k = (size + ((size_t)1 << PAGE_SHIFT) - 1) >> PAGE_SHIFT;
+        std::lock_guard<SpinMutex> lock(_pageMtx);
+        Span *span = NewSpan(k);
+        if (span == nullptr)
+        {
+            return nullptr;
+        }
+        span->_objSize = size;
+        return (void *)(span->_pageID << PAGE_SHIFT);
+    }
 
-                return kSpan;
+    // 同 AllocateLarge, 但返回清零的内存; span 仍是零页时省掉 memset
+    void *AllocateLargeZeroed(size_t size)
+    {
+        size_t k = (size + ((size_t)1 << PAGE_SHIFT) - 1) >> PAGE_SHIFT;
+        Span *span = nullptr;
+        {
+            std::lock_guard<SpinMutex> lock(_pageMtx);
+            span = NewSpan(k);
+            if (span == nullptr)
+            {
+                return nullptr;
             }
+            span->_objSize = size;
         }
 
-        Span *bigSpan = new Span;
-        void *ptr = SystemAlloc(NPAGES - 1);
-        bigSpan->_pageID = (PAGE_ID)ptr >> PAGE_SHIFT; // 得到大内存块的起始页号
-        bigSpan->_n = NPAGES - 1;
-        bigSpan->_isUse = false;
+        void *ptr = (void *)(span->_pageID << PAGE_SHIFT);
+        if (!span->_zeroed)
+        {
+            memset(ptr, 0, size);
+        }
+        return ptr;
+    }
+
+    void FreeLarge(void *ptr)
+    {
+        Span *span = MapObjectToSpan(ptr);
+        std::lock_guard<SpinMutex> lock(_pageMtx);
+        ReleaseSpanToPageCache(span);
+    }
+
+    // 堆占用: Grow 向系统映射的字节数减去已还给系统的空闲页, 软/硬上限都按它比较.
+    // 基数树节点等元数据不计入
+    size_t HeapBytes()
+    {
+        return _mappedBytes.load(std::memory_order_relaxed) - _releasedBytes.load(std::memory_order_relaxed);
+    }
 
-        MapSpan(bigSpan);
-        _spanLists[bigSpan->_n].PushFront(bigSpan);
+    // 0 表示不限制. 上限只在 Grow 向系统要内存时检查, 已经缓存的空闲 span 照常复用
+    void SetLimits(size_t softBytes, size_t hardBytes)
+    {
+        _softLimit.store(softBytes, std::memory_order_relaxed);
+        _hardLimit.store(hardBytes, std::memory_order_relaxed);
+    }
 
-        return NewSpan(k);
+    size_t SoftLimit()
+    {
+        return _softLimit.load(std::memory_order_relaxed);
     }
 
-    Span* MapObjectToSpan(void *obj)
+    size_t HardLimit()
     {
-        PAGE_ID id = ((PAGE_ID)obj >> PAGE_SHIFT); // 将obj强转为PAGE_ID, 然后右移PAGE_SHIFT位,得到页号
-        std::lock_guard<std::mutex> lock(_idSpanMtx);
-        auto ret = _idSpanMap.find(id);
-        if (ret != _idSpanMap.end())
+        return _hardLimit.load(std::memory_order_relaxed);
+    }
+
+    // 每次触及上限加一, 线程缓存在慢路径上发现变化后清空自己 (见 ThreadCache::TickSlowPath)
+    uint64_t PressureEpoch()
+    {
+        return _pressureEpoch.load(std::memory_order_relaxed);
+    }
+
+    // 取走待处理的压力事件; 回调和中心缓存回收需要在不持锁时进行, 由分配慢路径调用 cmp::HandleMemoryPressure
+    bool TakePressure()
+    {
+        return _pressurePending.load(std::memory_order_relaxed) &&
+               _pressurePending.exchange(false, std::memory_order_relaxed);
+    }
+
+    // 把空闲 span 的物理页还给系统, 直到释放了至少 bytes 字节, 返回实际释放的字节数.
+    // 先处理最大的 span, 系统调用次数最少. 调用方持有 _pageMtx
+    size_t ReleaseFreePages(size_t bytes)
+    {
+        size_t released = 0;
+        for (std::set<Span *, SpanBestFitLess>::reverse_iterator it = _largeSpans.rbegin();
+             it != _largeSpans.rend() && released < bytes; ++it)
         {
-            return ret->second;
+            released += ReleaseSpanPages(*it);
         }
-        else
+        for (size_t i = NPAGES - 1; i > 0 && released < bytes; --i)
         {
-            assert(false);
-            return nullptr;
+            for (Span *span = _spanLists[i].Begin(); span != _spanLists[i].End() && released < bytes; span = span->_next)
+            {
+                released += ReleaseSpanPages(span);
+            }
         }
+        return released;
+    }
 
+    // 一次映射 k 页作为一整个空闲 span (见 cmp::ReserveHeap), 之后的 NewSpan 从中切分, 不再逐次向系统申请.
+    // 同样受内存上限约束; 超过硬上限或系统拒绝时返回 false. 调用方持有 _pageMtx
+    bool Reserve(size_t k, bool populate)
+    {
+        if (k == 0 || !WithinLimits(k << PAGE_SHIFT))
+        {
+            return false;
+        }
+        return MapSpan(k, populate);
     }
 
-    void ReleaseSpanToPageCache(Span* span)
+    alignas(CACHE_LINE_SIZE) SpinMutex _pageMtx;
+
+private:
+    // 与前后相邻的空闲 span 合并后放回空闲索引; 只有两边都是零页时合并结果才算零页
+    void Coalesce(Span *span)
     {
-        assert(span);
-        UnMapSpan(span);
+        span->_isUse = false;
 
         // 对span前后的页进行合并,缓解外内存碎片问题
         while(1)
@@ -85,24 +224,19 @@ public:
             PAGE_ID prevId = span->_pageID - 1;
             Span* prevSpan = FindSpanByPageId(prevId);
             if (prevSpan == nullptr)
-            {   
-                break;
-            }
-            if (prevSpan->_isUse == true)
             {
                 break;
             }
-
-            if (prevSpan->_n + span->_n > NPAGES - 1)
+            // 已还给系统的页只与同样已释放的 span 合并, 堆占用的统计因此始终准确
+            if (prevSpan->_isUse == true || prevSpan->_released != span->_released)
             {
                 break;
             }
 
-            UnMapSpan(prevSpan);
+            RemoveFreeSpan(prevSpan);
             span->_pageID = prevSpan->_pageID;
             span->_n += prevSpan->_n;
-
-            _spanLists[prevSpan->_n].Erase(prevSpan);
+            span->_zeroed = span->_zeroed && prevSpan->_zeroed;
             delete prevSpan;
         }
 
@@ -114,65 +248,181 @@ public:
             {
                 break;
             }
-            if (nextSpan->_isUse == true)
+            if (nextSpan->_isUse == true || nextSpan->_released != span->_released)
             {
                 break;
             }
-            
-            if (nextSpan->_n + span->_n > NPAGES - 1)
-            {
-                break;
-            } 
-            UnMapSpan(nextSpan);
+
+            RemoveFreeSpan(nextSpan);
             span->_n += nextSpan->_n;
-            _spanLists[nextSpan->_n].Erase(nextSpan);
+            span->_zeroed = span->_zeroed && nextSpan->_zeroed;
             delete nextSpan;
         }
 
-        _spanLists[span->_n].PushFront(span);
-        span->_isUse = false;
-        MapSpan(span);
+        InsertFreeSpan(span);
+    }
+
+    size_t ReleaseSpanPages(Span *span)
+    {
+        if (span->_released || !SystemRelease((void *)(span->_pageID << PAGE_SHIFT), span->_n))
+        {
+            return 0;
+        }
+        span->_released = true;
+        span->_zeroed = true; // 再次访问时系统给的是零页
+        size_t bytes = span->_n << PAGE_SHIFT;
+        _releasedBytes.fetch_add(bytes, std::memory_order_relaxed);
+        return bytes;
     }
 
+    // 超过软上限: 先把空闲页还给系统, 再登记一次压力事件, 照常增长;
+    // 释放之后仍会超过硬上限时拒绝增长
+    bool WithinLimits(size_t bytes)
+    {
+        size_t soft = _softLimit.load(std::memory_order_relaxed);
+        size_t hard = _hardLimit.load(std::memory_order_relaxed);
+        if (soft == 0 && hard == 0)
+        {
+            return true;
+        }
 
-    std::mutex _pageMtx;
+        size_t heap = HeapBytes();
+        if (soft != 0 && heap + bytes > soft)
+        {
+            ReleaseFreePages(heap + bytes - soft);
+            RaisePressure();
+            heap = HeapBytes();
+        }
+        if (hard != 0 && heap + bytes > hard)
+        {
+            ReleaseFreePages(heap + bytes - hard);
+            RaisePressure();
+            return HeapBytes() + bytes <= hard;
+        }
+        return true;
+    }
 
-private:
-    Span *FindSpanByPageId(PAGE_ID id)
+    void RaisePressure()
     {
-        std::lock_guard<std::mutex> lock(_idSpanMtx);
-        auto ret = _idSpanMap.find(id);
-        if (ret == _idSpanMap.end())
+        _pressureEpoch.fetch_add(1, std::memory_order_relaxed);
+        _pressurePending.store(true, std::memory_order_relaxed);
+    }
+
+    // 小于 NPAGES 页: 从 k 开始找第一个非空的定长桶, 即最佳匹配;
+    // 否则在大 span 集合里找页数 >= k 中最小、同页数中地址最低的
+    Span *FindBestFit(size_t k)
+    {
+        for (size_t i = k; i < NPAGES; i++)
+        {
+            if (!_spanLists[i].Empty())
+            {
+                return _spanLists[i].PopFront();
+            }
+        }
+
+        Span probe;
+        probe._n = k;
+        probe._pageID = 0;
+        std::set<Span *, SpanBestFitLess>::iterator it = _largeSpans.lower_bound(&probe);
+        if (it == _largeSpans.end())
         {
             return nullptr;
         }
-        return ret->second;
+        Span *span = *it;
+        _largeSpans.erase(it);
+        return span;
     }
 
-    void MapSpan(Span *span)
+    // 向系统申请至少 NPAGES - 1 页, 作为空闲的零页 span 并入 (与相邻的空闲 span 合并).
+    // 上限附近按 k 页申请; 超过硬上限或系统拒绝时返回 false
+    bool Grow(size_t k)
     {
-        assert(span);
-        std::lock_guard<std::mutex> lock(_idSpanMtx);
-        for (size_t i = 0; i < span->_n; ++i)
+        size_t n = k > NPAGES - 1 ? k : NPAGES - 1;
+        if (!WithinLimits(n << PAGE_SHIFT))
+        {
+            n = k;
+            if (!WithinLimits(n << PAGE_SHIFT))
+            {
+                return false;
+            }
+        }
+        return MapSpan(n, false);
+    }
+
+    // 向系统映射 n 页作为空闲的零页 span 并入, 系统拒绝时返回 false
+    bool MapSpan(size_t n, bool populate)
+    {
+        void *ptr = SystemTryAlloc(n, populate);
+        if (ptr == nullptr)
         {
-            _idSpanMap[span->_pageID + i] = span;
+            return false;
         }
+        _mappedBytes.fetch_add(n << PAGE_SHIFT, std::memory_order_relaxed);
+        Span *span = new Span;
+        span->_pageID = (PAGE_ID)ptr >> PAGE_SHIFT; // 得到大内存块的起始页号
+        span->_n = n;
+        span->_zeroed = true; // mmap 得到的匿名页全为零
+        _idSpanMap.Ensure(span->_pageID, n);
+        Coalesce(span);
+        return true;
     }
 
-    void UnMapSpan(Span *span)
+    // 空闲 span 只登记首尾两页, 合并时只会查到相邻 span 的边界页
+    void InsertFreeSpan(Span *span)
+    {
+        span->_isUse = false;
+        if (span->_n < NPAGES)
+        {
+            _spanLists[span->_n].PushFront(span);
+        }
+        else
+        {
+            _largeSpans.insert(span);
+        }
+        _idSpanMap.Set(span->_pageID, span);
+        _idSpanMap.Set(span->_pageID + span->_n - 1, span);
+    }
+
+    void RemoveFreeSpan(Span *span)
+    {
+        if (span->_n < NPAGES)
+        {
+            _spanLists[span->_n].Erase(span);
+        }
+        else
+        {
+            _largeSpans.erase(span);
+        }
+    }
+
+    Span *FindSpanByPageId(PAGE_ID id)
+    {
+        return _idSpanMap.Get(id);
+    }
+
+    // 使用中的 span 登记所有页, 任意对象地址都能查到所属 span
+    void MapSpan(Span *span)
     {
         assert(span);
-        std::lock_guard<std::mutex> lock(_idSpanMtx);
         for (size_t i = 0; i < span->_n; ++i)
         {
-            _idSpanMap.erase(span->_pageID + i);
+            _idSpanMap.Set(span->_pageID + i, span);
         }
     }
 
     SpanList _spanLists[NPAGES];
+    std::set<Span *, SpanBestFitLess> _largeSpans;
 
-    std::unordered_map<PAGE_ID, Span*> _idSpanMap;
-    std::mutex _idSpanMtx;
+    // 页号到 span 的映射, 由 _pageMtx 保护写入
+    PageMap3<PAGE_MAP_BITS> _idSpanMap;
+
+    // 以下在 _pageMtx 内修改; 原子类型是为了不加锁读取统计
+    std::atomic<size_t> _mappedBytes{0};
+    std::atomic<size_t> _releasedBytes{0};
+    std::atomic<size_t> _softLimit{0};
+    std::atomic<size_t> _hardLimit{0};
+    std::atomic<uint64_t> _pressureEpoch{0};
+    std::atomic<bool> _pressurePending{false};
 
     PageCache()
     {
@@ -180,7 +430,5 @@ private:
 
     PageCache(const PageCache &) = delete;
 
-    static PageCache _sInst;
+    static PageCache _sInst; // 定义在 PageCache.cc
 };
-
-PageCache PageCache::_sInst;
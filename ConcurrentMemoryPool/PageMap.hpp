@@ -0,0 +1,103 @@
+#pragma once
+
+#include "Common.hpp"
+
+// 用户态虚拟地址的有效位数: 64 位平台按 48 位计算
+static const int PAGE_MAP_BITS = (sizeof(void *) == 8 ? 48 : 32) - (int)PAGE_SHIFT;
+
+// 页号 -> Span 的三层基数树 (参考 tcmalloc 的 PageMap3).
+// 写操作 (Set / Ensure) 只在 PageCache::_pageMtx 保护下进行;
+// 读操作不加锁: 对象在被分配出去之前, 它所在页的映射已经通过锁建立好,
+// 之后只要 span 还在使用, 这些页的映射就不会再被修改.
+// 中间节点和叶子一旦分配就不再释放, 所以并发读到的节点指针始终有效.
+template <int BITS>
+class PageMap3
+{
+public:
+    PageMap3()
+    {
+        _root = NewNode();
+    }
+
+    Span *Get(PAGE_ID id) const
+    {
+        const PAGE_ID i1 = id >> (LEAF_BITS + INTERIOR_BITS);
+        const PAGE_ID i2 = (id >> LEAF_BITS) & (INTERIOR_LENGTH - 1);
+        const PAGE_ID i3 = id & (LEAF_LENGTH - 1);
+        if ((id >> BITS) > 0 || _root->_ptrs[i1] == nullptr)
+        {
+            return nullptr;
+        }
+        Node *n2 = static_cast<Node *>(_root->_ptrs[i1]);
+        if (n2->_ptrs[i2] == nullptr)
+        {
+            return nullptr;
+        }
+        return static_cast<Leaf *>(n2->_ptrs[i2])->_values[i3];
+    }
+
+    // 调用前需保证 [id, id + 1) 所在的节点已由 Ensure 分配
+    void Set(PAGE_ID id, Span *span)
+    {
+        assert((id >> BITS) == 0);
+        const PAGE_ID i1 = id >> (LEAF_BITS + INTERIOR_BITS);
+        const PAGE_ID i2 = (id >> LEAF_BITS) & (INTERIOR_LENGTH - 1);
+        const PAGE_ID i3 = id & (LEAF_LENGTH - 1);
+        Node *n2 = static_cast<Node *>(_root->_ptrs[i1]);
+        static_cast<Leaf *>(n2->_ptrs[i2])->_values[i3] = span;
+    }
+
+    // 为 [start, start + n) 这段页号分配中间节点和叶子
+    void Ensure(PAGE_ID start, size_t n)
+    {
+        for (PAGE_ID key = start; key <= start + n - 1;)
+        {
+            assert((key >> BITS) == 0);
+            const PAGE_ID i1 = key >> (LEAF_BITS + INTERIOR_BITS);
+            const PAGE_ID i2 = (key >> LEAF_BITS) & (INTERIOR_LENGTH - 1);
+
+            if (_root->_ptrs[i1] == nullptr)
+            {
+                _root->_ptrs[i1] = NewNode();
+            }
+
+            Node *n2 = static_cast<Node *>(_root->_ptrs[i1]);
+            if (n2->_ptrs[i2] == nullptr)
+            {
+                n2->_ptrs[i2] = NewLeaf();
+            }
+
+            // 跳到下一个叶子覆盖的范围
+            key = ((key >> LEAF_BITS) + 1) << LEAF_BITS;
+        }
+    }
+
+private:
+    static const int INTERIOR_BITS = (BITS + 2) / 3;
+    static const size_t INTERIOR_LENGTH = (size_t)1 << INTERIOR_BITS;
+    static const int LEAF_BITS = BITS - 2 * INTERIOR_BITS;
+    static const size_t LEAF_LENGTH = (size_t)1 << LEAF_BITS;
+
+    struct Node
+    {
+        void *_ptrs[INTERIOR_LENGTH];
+    };
+
+    struct Leaf
+    {
+        Span *_values[LEAF_LENGTH];
+    };
+
+    // 节点直接向系统申请, mmap 得到的内存已清零
+    static Node *NewNode()
+    {
+        return static_cast<Node *>(SystemAlloc((sizeof(Node) + (1 << PAGE_SHIFT) - 1) >> PAGE_SHIFT));
+    }
+
+    static Leaf *NewLeaf()
+    {
+        return static_cast<Leaf *>(SystemAlloc((sizeof(Leaf) + (1 << PAGE_SHIFT) - 1) >> PAGE_SHIFT));
+    }
+
+    Node *_root;
+};
@@ -0,0 +1,115 @@
+#include <cstdlib>
+#include <mutex>
+
+#include "Prewarm.hpp"
+#include "CentralCache.hpp"
+#include "ShardedHeap.hpp"
+#include "ThreadCache.hpp"
+
+namespace cmp
+{
+namespace
+{
+// 逗号分隔的字节数, 无法解析的项跳过
+std::vector<size_t> ParseSizes(const char *text)
+{
+    std::vector<size_t> sizes;
+    while (text != nullptr && *text != '\0')
+    {
+        char *end = nullptr;
+        unsigned long long size = std::strtoull(text, &end, 10);
+        if (end == text)
+        {
+            ++text;
+            continue;
+        }
+        sizes.push_back((size_t)size);
+        text = end;
+    }
+    return sizes;
+}
+
+bool EnvFlag(const char *name)
+{
+    const char *value = std::getenv(name);
+    return value != nullptr && *value != '\0' && *value != '0';
+}
+} // namespace
+
+bool ReserveHeap(size_t bytes, bool populate)
+{
+    size_t k = (bytes + ((size_t)1 << PAGE_SHIFT) - 1) >> PAGE_SHIFT;
+    std::lock_guard<SpinMutex> lock(PageCache::GetInstance()->_pageMtx);
+    return PageCache::GetInstance()->Reserve(k, populate);
+}
+
+size_t PrewarmCentralCache(const std::vector<size_t> &sizes)
+{
+#if defined(CMP_SHARDED_ENGINE) && CMP_SHARDED_ENGINE
+    (void)sizes;
+    return 0;
+#else
+    size_t filled = 0;
+    for (size_t i = 0; i < sizes.size(); ++i)
+    {
+        size_t size = sizes[i];
+        if (size <= THREAD_CACHE_MAX_BYTES)
+        {
+            filled += CentralCache::GetInstance()->Prewarm(SizeClass::RoundUp(size == 0 ? 1 : size));
+        }
+    }
+    return filled;
+#endif
+}
+
+void WarmThreadCache(const std::vector<size_t> &sizes)
+{
+#if defined(CMP_SHARDED_ENGINE) && CMP_SHARDED_ENGINE
+    // 分片堆没有可以预先装满的链表, 分配再释放一次, 创建分片堆并取好各尺寸类的当前页
+    for (size_t i = 0; i < sizes.size(); ++i)
+    {
+        size_t size = sizes[i] == 0 ? 1 : sizes[i];
+        if (size <= THREAD_CACHE_MAX_BYTES)
+        {
+            void *ptr = ShardedAlloc(size);
+            if (ptr != nullptr)
+            {
+                ShardedFree(ptr, size);
+            }
+        }
+    }
+#else
+    if (pTLSThreadCache == nullptr)
+    {
+        pTLSThreadCache = CreateThreadCache();
+    }
+    for (size_t i = 0; i < sizes.size(); ++i)
+    {
+        if (sizes[i] <= THREAD_CACHE_MAX_BYTES)
+        {
+            pTLSThreadCache->Warm(sizes[i]);
+        }
+    }
+#endif
+}
+
+const std::vector<size_t> &StartupPrewarmSizes()
+{
+    static const std::vector<size_t> sizes = ParseSizes(std::getenv("CMP_PREWARM_SIZES"));
+    return sizes;
+}
+} // namespace cmp
+
+void ApplyStartupPrewarm()
+{
+    const char *reserveMB = std::getenv("CMP_RESERVE_MB");
+    if (reserveMB != nullptr)
+    {
+        size_t mb = (size_t)std::strtoull(reserveMB, nullptr, 10);
+        if (mb > 0)
+        {
+            cmp::ReserveHeap(mb << 20, cmp::EnvFlag("CMP_RESERVE_POPULATE"));
+        }
+    }
+    cmp::PrewarmCentralCache(cmp::StartupPrewarmSizes());
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// 冷启动预热: 进程刚启动或线程刚创建时, 第一次分配要依次经历创建线程缓存、中心缓存切分 span、
+// PageCache 向系统映射内存和首次访问的缺页, 部署后的第一批请求因此出现延迟尖刺. 这里把这些工作提前做掉:
+// - ReserveHeap: 一次映射一整块堆作为空闲 span, 可选 MAP_POPULATE 预先分配物理页;
+// - PrewarmCentralCache: 为热点尺寸类切好 span, 填满中心缓存的转移缓存;
+// - WarmThreadCache: 工作线程启动时调用, 创建线程缓存并为热点尺寸类各装满一批对象.
+// 预留的页和其他空闲页一样, 会被 ReleaseFreeMemory/TrimTo 和内存上限的处理还给系统.
+// 进程启动时 (静态初始化阶段) 按环境变量执行前两步:
+//   CMP_RESERVE_MB=N         预留 N MB
+//   CMP_RESERVE_POPULATE=1   预留时使用 MAP_POPULATE
+//   CMP_PREWARM_SIZES=a,b,…  预热这些字节数所在的尺寸类, 工作线程可以用 StartupPrewarmSizes() 取回
+// 接口定义在 Prewarm.cc.
+namespace cmp
+{
+// 预留 bytes 字节 (按页向上取整) 的空闲堆, 受内存上限约束. 超过硬上限或系统拒绝时返回 false
+bool ReserveHeap(size_t bytes, bool populate = false);
+
+// 为每个大小所在的尺寸类填满中心缓存的转移缓存, 超过 THREAD_CACHE_MAX_BYTES 的大小忽略.
+// 返回放入的对象总数; 分片引擎没有中心缓存, 返回 0
+size_t PrewarmCentralCache(const std::vector<size_t> &sizes);
+
+// 调用线程: 创建线程缓存 (分片引擎下为分片堆), 各尺寸类跳过慢开始并取满一批对象.
+// 超过 THREAD_CACHE_MAX_BYTES 的大小忽略
+void WarmThreadCache(const std::vector<size_t> &sizes);
+
+// CMP_PREWARM_SIZES 解析出的大小, 未设置时为空
+const std::vector<size_t> &StartupPrewarmSizes();
+} // namespace cmp
+
+// PageCache.cc 的静态初始化中调用, 按环境变量预留和预热
+void ApplyStartupPrewarm();
@@ -0,0 +1,49 @@
+#include "ShardedHeap.hpp"
+#include "Fork.hpp"
+
+CMP_TLS ShardedHeap *pTLSShardedHeap = nullptr;
+
+// 所有创建过的堆, 只在创建堆和 fork 时访问
+class ShardedHeapRegistry
+{
+public:
+    static ShardedHeapRegistry *GetInstance()
+    {
+        static ShardedHeapRegistry inst;
+        return &inst;
+    }
+
+    void Add(ShardedHeap *heap)
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _heaps.push_back(heap);
+    }
+
+    std::mutex _mtx;
+    std::vector<ShardedHeap *> _heaps;
+};
+
+ShardedHeap *CreateShardedHeap()
+{
+    static thread_local ShardedHeapReleaser releaser;
+    ShardedHeap *heap = OrphanShardedHeaps::GetInstance()->Pop();
+    if (heap == nullptr)
+    {
+        heap = new ShardedHeap;
+        ShardedHeapRegistry::GetInstance()->Add(heap);
+    }
+    releaser._heap = heap;
+    return heap;
+}
+
+void ShardedHeapsLockForFork()
+{
+    ShardedHeapRegistry::GetInstance()->_mtx.lock();
+    OrphanShardedHeaps::GetInstance()->_mtx.lock();
+}
+
+void ShardedHeapsUnlockForFork()
+{
+    OrphanShardedHeaps::GetInstance()->_mtx.unlock();
+    ShardedHeapRegistry::GetInstance()->_mtx.unlock();
+}
@@ -0,0 +1,437 @@
+#pragma once
+
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "Common.hpp"
+#include "PageCache.hpp"
+
+// 按页分片自由链表的分配引擎 (参考 mimalloc), 可与 ThreadCache/CentralCache 对照:
+// 每个线程一个 ShardedHeap, 每个尺寸类有一个当前页 (直接从 PageCache 取的 span),
+// 页内维护三条自由链表:
+//   _free        分配只从这里取
+//   _localFree   所属线程释放的对象, _free 用完后整体换入
+//   _threadFree  其他线程释放的对象, 无锁压入, 所属线程整批收回
+// 分配总是先用完一个页再换下一个, 连续分配的对象落在同一页上, 缓存和 TLB 局部性更好.
+// 页之间不共享, 也没有中心缓存: 空页直接还给 PageCache.
+// 入口为 ShardedAlloc/ShardedFree; 编译时定义 CMP_SHARDED_ENGINE=1 可让 ConcurrentAlloc 改用本引擎.
+
+class ShardedHeap;
+
+// 页元数据, 放在 span 的起始位置
+struct ShardedPage
+{
+    void *_free = nullptr;
+    void *_localFree = nullptr;
+    std::atomic<void *> _threadFree{nullptr};
+
+    size_t _used = 0;     // 已分配且尚未被所属线程收回的对象数 (含 _threadFree 中的)
+    size_t _objSize = 0;
+    char *_bump = nullptr; // 尚未切分的区域, 按需分批切分, 避免一次性触碰整页内存
+    char *_end = nullptr;
+
+    Span *_span = nullptr;
+    ShardedHeap *_heap = nullptr;
+    ShardedPage *_next = nullptr;
+    ShardedPage *_prev = nullptr;
+    bool _full = false;
+};
+
+static const size_t SHARDED_PAGE_HEADER = (sizeof(ShardedPage) + 15) & ~(size_t)15;
+
+// 按页分组的双向链表, 不带哨兵
+struct ShardedPageList
+{
+    ShardedPage *_head = nullptr;
+
+    void PushFront(ShardedPage *page)
+    {
+        page->_prev = nullptr;
+        page->_next = _head;
+        if (_head != nullptr)
+        {
+            _head->_prev = page;
+        }
+        _head = page;
+    }
+
+    void Erase(ShardedPage *page)
+    {
+        if (page->_prev != nullptr)
+        {
+            page->_prev->_next = page->_next;
+        }
+        else
+        {
+            _head = page->_next;
+        }
+        if (page->_next != nullptr)
+        {
+            page->_next->_prev = page->_prev;
+        }
+        page->_next = nullptr;
+        page->_prev = nullptr;
+    }
+};
+
+class ShardedHeap
+{
+public:
+    void *Allocate(size_t size)
+    {
+        assert(size <= THREAD_CACHE_MAX_BYTES);
+        size_t index = SizeClass::Index(size);
+        ShardedPage *page = _current[index];
+        if (page != nullptr && page->_free != nullptr)
+        {
+            return Pop(page);
+        }
+        return AllocateSlow(index, SizeClass::RoundUp(size));
+    }
+
+    // 所属线程释放: 放入页的 _localFree
+    void FreeLocal(ShardedPage *page, void *ptr)
+    {
+        NextObj(ptr) = page->_localFree;
+        page->_localFree = ptr;
+        page->_used--;
+
+        size_t index = SizeClass::Index(page->_objSize);
+        if (page->_full)
+        {
+            _fullPages[index].Erase(page);
+            _pages[index].PushFront(page);
+            page->_full = false;
+        }
+
+        if (page->_used == 0 && page != _current[index])
+        {
+            _pages[index].Erase(page);
+            RetirePage(page);
+        }
+    }
+
+    // 其他线程释放: 无锁压入页的 _threadFree
+    static void FreeRemote(ShardedPage *page, void *ptr)
+    {
+        void *head = page->_threadFree.load(std::memory_order_relaxed);
+        do
+        {
+            NextObj(ptr) = head;
+        } while (!page->_threadFree.compare_exchange_weak(head, ptr, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // 收回所有页上的远程释放, 并把空页还给 PageCache (线程退出时调用)
+    void Collect()
+    {
+        for (size_t i = 0; i < NFREELIST; ++i)
+        {
+            _current[i] = nullptr;
+            CollectList(_fullPages[i], i);
+            CollectList(_pages[i], i);
+        }
+    }
+
+private:
+    static void *Pop(ShardedPage *page)
+    {
+        void *obj = page->_free;
+        page->_free = NextObj(obj);
+        CMP_PREFETCH(page->_free);
+        page->_used++;
+        return obj;
+    }
+
+    void *AllocateSlow(size_t index, size_t size)
+    {
+        ShardedPage *page = _current[index];
+        if (page != nullptr && CollectPage(page))
+        {
+            return Pop(page);
+        }
+
+        // 当前页已满, 移入满页链表, 在本尺寸类的其他页里找可用的
+        if (page != nullptr)
+        {
+            _pages[index].Erase(page);
+            _fullPages[index].PushFront(page);
+            page->_full = true;
+            _current[index] = nullptr;
+        }
+
+        ShardedPage *it = _pages[index]._head;
+        while (it != nullptr)
+        {
+            ShardedPage *next = it->_next;
+            if (CollectPage(it))
+            {
+                _current[index] = it;
+                return Pop(it);
+            }
+            _pages[index].Erase(it);
+            _fullPages[index].PushFront(it);
+            it->_full = true;
+            it = next;
+        }
+
+        // 满页上可能积累了其他线程释放的对象, 申请新页前先收回
+        it = _fullPages[index]._head;
+        while (it != nullptr)
+        {
+            ShardedPage *next = it->_next;
+            if (it->_threadFree.load(std::memory_order_relaxed) != nullptr && CollectPage(it))
+            {
+                _fullPages[index].Erase(it);
+                _pages[index].PushFront(it);
+                it->_full = false;
+                _current[index] = it;
+                return Pop(it);
+            }
+            it = next;
+        }
+
+        page = NewPage(index, size);
+        if (page == nullptr)
+        {
+            return nullptr;
+        }
+        _current[index] = page;
+        CollectPage(page);
+        return Pop(page);
+    }
+
+    // 让 page->_free 非空: 依次换入 _localFree, 收回 _threadFree, 切分新对象
+    static bool CollectPage(ShardedPage *page)
+    {
+        if (page->_free != nullptr)
+        {
+            return true;
+        }
+
+        CollectRemote(page);
+        if (page->_localFree != nullptr)
+        {
+            page->_free = page->_localFree;
+            page->_localFree = nullptr;
+            return true;
+        }
+
+        if (page->_bump + page->_objSize <= page->_end)
+        {
+            // 一次最多切 64 个对象, 按地址顺序链接
+            char *start = page->_bump;
+            size_t n = (size_t)(page->_end - start) / page->_objSize;
+            if (n > 64)
+            {
+                n = 64;
+            }
+            void *head = nullptr;
+            for (size_t i = n; i > 0; --i)
+            {
+                void *obj = start + (i - 1) * page->_objSize;
+                NextObj(obj) = head;
+                head = obj;
+            }
+            page->_bump = start + n * page->_objSize;
+            page->_free = head;
+            return true;
+        }
+
+        return false;
+    }
+
+    // 把 _threadFree 整批移到 _localFree
+    static void CollectRemote(ShardedPage *page)
+    {
+        if (page->_threadFree.load(std::memory_order_relaxed) == nullptr)
+        {
+            return;
+        }
+
+        void *start = page->_threadFree.exchange(nullptr, std::memory_order_acquire);
+        void *end = start;
+        size_t n = 1;
+        while (NextObj(end) != nullptr)
+        {
+            end = NextObj(end);
+            ++n;
+        }
+        NextObj(end) = page->_localFree;
+        page->_localFree = start;
+        page->_used -= n;
+    }
+
+    void CollectList(ShardedPageList &list, size_t index)
+    {
+        ShardedPage *page = list._head;
+        while (page != nullptr)
+        {
+            ShardedPage *next = page->_next;
+            CollectRemote(page);
+            if (page->_used == 0)
+            {
+                list.Erase(page);
+                RetirePage(page);
+            }
+            else if (page->_full)
+            {
+                _fullPages[index].Erase(page);
+                _pages[index].PushFront(page);
+                page->_full = false;
+            }
+            page = next;
+        }
+    }
+
+    // 页大小: 至少 8 页 (64KB), 且能放下 8 个对象
+    static size_t PageCount(size_t size)
+    {
+        size_t bytes = size * 8 + SHARDED_PAGE_HEADER;
+        size_t k = (bytes + ((size_t)1 << PAGE_SHIFT) - 1) >> PAGE_SHIFT;
+        if (k < 8)
+        {
+            k = 8;
+        }
+        return k < NPAGES - 1 ? k : NPAGES - 1;
+    }
+
+    // 超过硬上限时返回 nullptr
+    ShardedPage *NewPage(size_t index, size_t size)
+    {
+        PageCache::GetInstance()->_pageMtx.lock();
+        Span *span = PageCache::GetInstance()->NewSpan(PageCount(size));
+        PageCache::GetInstance()->_pageMtx.unlock();
+        if (span == nullptr)
+        {
+            return nullptr;
+        }
+        span->_objSize = size;
+
+        char *base = reinterpret_cast<char *>(span->_pageID << PAGE_SHIFT);
+        ShardedPage *page = new (base) ShardedPage;
+        page->_objSize = size;
+        page->_bump = base + SHARDED_PAGE_HEADER;
+        page->_end = base + (span->_n << PAGE_SHIFT);
+        page->_span = span;
+        page->_heap = this;
+
+        _pages[index].PushFront(page);
+        return page;
+    }
+
+    static void RetirePage(ShardedPage *page)
+    {
+        Span *span = page->_span;
+        page->~ShardedPage();
+
+        PageCache::GetInstance()->_pageMtx.lock();
+        PageCache::GetInstance()->ReleaseSpanToPageCache(span);
+        PageCache::GetInstance()->_pageMtx.unlock();
+    }
+
+    ShardedPage *_current[NFREELIST] = {nullptr};
+    ShardedPageList _pages[NFREELIST];     // 可能还有空闲对象的页
+    ShardedPageList _fullPages[NFREELIST]; // 已满的页
+};
+
+// 定义在 ShardedHeap.cc
+extern CMP_TLS ShardedHeap *pTLSShardedHeap;
+
+// 已退出线程留下的堆, 由新线程接管
+class OrphanShardedHeaps
+{
+public:
+    static OrphanShardedHeaps *GetInstance()
+    {
+        static OrphanShardedHeaps inst;
+        return &inst;
+    }
+
+    void Push(ShardedHeap *heap)
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _heaps.push_back(heap);
+    }
+
+    ShardedHeap *Pop()
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (_heaps.empty())
+        {
+            return nullptr;
+        }
+        ShardedHeap *heap = _heaps.back();
+        _heaps.pop_back();
+        return heap;
+    }
+
+    // 以下由 fork 处理函数直接访问 (见 ShardedHeap.cc)
+    std::mutex _mtx;
+    std::vector<ShardedHeap *> _heaps;
+};
+
+// 线程退出时收回远程释放并归还空页, 堆本身不销毁而是交给新线程接管,
+// 之后到达的远程释放由接管者收回
+struct ShardedHeapReleaser
+{
+    ShardedHeap *_heap = nullptr;
+
+    ~ShardedHeapReleaser()
+    {
+        if (_heap == nullptr)
+        {
+            return;
+        }
+        _heap->Collect();
+        OrphanShardedHeaps::GetInstance()->Push(_heap);
+        pTLSShardedHeap = nullptr;
+    }
+};
+
+// 创建当前线程的堆, 优先接管已退出线程的堆
+ShardedHeap *CreateShardedHeap();
+
+inline void *ShardedAlloc(size_t size)
+{
+    if (size == 0)
+    {
+        size = 1;
+    }
+
+    if (size > THREAD_CACHE_MAX_BYTES)
+    {
+        return PageCache::GetInstance()->AllocateLarge(size);
+    }
+
+    if (pTLSShardedHeap == nullptr)
+    {
+        pTLSShardedHeap = CreateShardedHeap();
+    }
+    return pTLSShardedHeap->Allocate(size);
+}
+
+inline void ShardedFree(void *ptr, size_t size)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+
+    if (size > THREAD_CACHE_MAX_BYTES)
+    {
+        PageCache::GetInstance()->FreeLarge(ptr);
+        return;
+    }
+
+    Span *span = PageCache::GetInstance()->MapObjectToSpan(ptr);
+    ShardedPage *page = reinterpret_cast<ShardedPage *>(span->_pageID << PAGE_SHIFT);
+    if (pTLSShardedHeap != nullptr && page->_heap == pTLSShardedHeap)
+    {
+        pTLSShardedHeap->FreeLocal(page, ptr);
+    }
+    else
+    {
+        ShardedHeap::FreeRemote(page, ptr);
+    }
+}
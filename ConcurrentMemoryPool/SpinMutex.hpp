@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+static const size_t CACHE_LINE_SIZE = 64;
+
+// 锁的计数: 获取次数, 以及第一次尝试没拿到、进入慢路径的次数
+struct LockStats
+{
+    uint64_t _acquisitions = 0;
+    uint64_t _contended = 0;
+
+    LockStats &operator+=(const LockStats &other)
+    {
+        _acquisitions += other._acquisitions;
+        _contended += other._contended;
+        return *this;
+    }
+};
+
+inline void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+// 先自旋再挂起的互斥锁, 用来替换中心缓存/页缓存里临界区只有几十纳秒的 std::mutex.
+// 状态: 0 未加锁, 1 已加锁, 2 已加锁且可能有线程挂起 (参考 Drepper "Futexes Are Tricky").
+// 慢路径按 1, 2, 4 ... 次 pause 指数退避自旋, 仍拿不到则在 Linux 上用 futex 挂起, 其他平台 yield.
+// 本身不做缓存行对齐, 以便和它保护的数据放在同一缓存行; 布局由包含它的结构决定 (见 CentralFreeList).
+// 满足 Lockable, 可直接用于 std::lock_guard.
+class SpinMutex
+{
+public:
+    SpinMutex()
+    {}
+
+    SpinMutex(const SpinMutex &) = delete;
+    SpinMutex &operator=(const SpinMutex &) = delete;
+
+    void lock()
+    {
+        int expected = 0;
+        if (!_state.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            LockSlow();
+        }
+        // 持锁期间只有当前线程写, 不需要原子加
+        _acquisitions.store(_acquisitions.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    bool try_lock()
+    {
+        int expected = 0;
+        if (!_state.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            return false;
+        }
+        _acquisitions.store(_acquisitions.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void unlock()
+    {
+        if (_state.exchange(0, std::memory_order_release) == 2)
+        {
+            Wake();
+        }
+    }
+
+    LockStats Stats() const
+    {
+        LockStats stats;
+        stats._acquisitions = _acquisitions.load(std::memory_order_relaxed);
+        stats._contended = _contended.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    void LockSlow()
+    {
+        _contended.fetch_add(1, std::memory_order_relaxed);
+
+        for (int spin = 1; spin <= MaxSpin(); spin <<= 1)
+        {
+            for (int i = 0; i < spin; ++i)
+            {
+                CpuRelax();
+            }
+            int expected = 0;
+            if (_state.load(std::memory_order_relaxed) == 0 &&
+                _state.compare_exchange_weak(expected, 1, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                return;
+            }
+        }
+
+        // 标记为有等待者后挂起, 被唤醒后以 2 重新抢锁, 保证释放时不会漏掉其他等待者
+        while (_state.exchange(2, std::memory_order_acquire) != 0)
+        {
+            Wait();
+        }
+    }
+
+    // 单核机器上持锁线程不可能同时运行, 自旋没有意义, 直接挂起
+    static int MaxSpin()
+    {
+        static const int maxSpin = std::thread::hardware_concurrency() > 1 ? 64 : 0;
+        return maxSpin;
+    }
+
+    void Wait()
+    {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<int *>(&_state), FUTEX_WAIT_PRIVATE, 2, nullptr, nullptr, 0);
+#else
+        std::this_thread::yield();
+#endif
+    }
+
+    void Wake()
+    {
+#ifdef __linux__
+        syscall(SYS_futex, reinterpret_cast<int *>(&_state), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+    }
+
+    std::atomic<int> _state{0};
+    std::atomic<uint64_t> _acquisitions{0};
+    std::atomic<uint64_t> _contended{0};
+};
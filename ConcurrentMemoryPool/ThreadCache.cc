@@ -0,0 +1,449 @@
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "ThreadCache.hpp"
+#include "CentralCache.hpp"
+#include "Fork.hpp"
+#include "MemoryLimit.hpp"
+
+CMP_TLS ThreadCache *pTLSThreadCache = nullptr;
+
+uint8_t SizeClass::_classArray[SizeClass::CLASS_ARRAY_SIZE];
+
+// 每一格取格内最大的字节数求下标, 格内其余大小向上对齐后落在同一尺寸类
+void SizeClass::BuildClassArray()
+{
+    for (size_t slot = 0; slot < CLASS_ARRAY_SIZE; ++slot)
+    {
+        size_t bytes = slot <= 128 ? slot << 3 : (slot << 7) - (120 << 7);
+        if (bytes == 0)
+        {
+            bytes = 1;
+        }
+        _classArray[slot] = (uint8_t)Index(bytes);
+    }
+}
+
+// 快路径传进来的是使用方的原始大小 (可能为 0), 与中心缓存交互时用对齐后的尺寸类大小
+static size_t ClassBytes(size_t size)
+{
+    return SizeClass::RoundUp(size == 0 ? 1 : size);
+}
+
+ThreadCache::ThreadCache()
+{
+    static const bool built = (SizeClass::BuildClassArray(), true);
+    (void)built;
+
+    for (size_t i = 0; i < NFREELIST; ++i)
+    {
+        _maxSizes[i] = 1;
+    }
+    _pressureEpoch = PageCache::GetInstance()->PressureEpoch();
+#if CMP_REMOTE_FREE
+    for (size_t i = 0; i < NFREELIST; ++i)
+    {
+        _remoteFrees[i].store(nullptr, std::memory_order_relaxed);
+    }
+#endif
+}
+
+void *ThreadCache::AllocateSlow(size_t index, size_t size)
+{
+#if CMP_REMOTE_FREE
+    if (DrainRemoteFrees(index))
+    {
+        return _freeLists[index].Pop();
+    }
+#endif
+    void *obj = FetchFromCentralCache(index, ClassBytes(size));
+    if (CMP_UNLIKELY(obj == nullptr))
+    {
+        // 超过硬上限: 回调、清空缓存、回收空闲页之后再试一次
+        cmp::HandleMemoryPressure(cmp::MemoryPressure::kHard);
+        obj = FetchFromCentralCache(index, ClassBytes(size));
+    }
+    else if (CMP_UNLIKELY(PageCache::GetInstance()->TakePressure()))
+    {
+        cmp::HandleMemoryPressure(cmp::MemoryPressure::kSoft);
+    }
+    return obj;
+}
+
+void ThreadCache::ListTooLong(size_t index, size_t size)
+{
+    size = ClassBytes(size);
+    FreeList& list = _freeLists[index];
+    size_t batch = SizeClass::NumMoveSize(size);
+    size_t returnNum = batch;
+    if (_maxSizes[index] < batch)
+    {
+        // 慢开始阶段还回一半
+        returnNum = _maxSizes[index] / 2;
+        if (returnNum == 0)
+        {
+            returnNum = 1;
+        }
+    }
+    else if (_maxSizes[index] > batch && ++_stats[index]._overages > THREAD_CACHE_MAX_OVERAGES)
+    {
+        // 频繁溢出说明上限偏大, 收回一批
+        _maxSizes[index] -= batch;
+        _stats[index]._overages = 0;
+    }
+
+    void* start = nullptr;
+    void* end = nullptr;
+    list.PopRange(start, end, returnNum);
+
+    CentralCache::GetInstance()->ReleaseListToSpans(start, size, returnNum);
+    TickSlowPath();
+}
+
+void *ThreadCache::FetchFromCentralCache(size_t index, size_t size)
+{
+    //慢开始反馈调节算法
+    size_t maxMoveNum = SizeClass::NumMoveSize(size);
+    size_t currentMaxSize = _maxSizes[index];
+    size_t batchNum = std::min(currentMaxSize, maxMoveNum);
+
+    _stats[index]._underflows++;
+    if (_maxSizes[index] < maxMoveNum)
+    {
+        size_t grown = _maxSizes[index] * 2;
+        _maxSizes[index] = std::min(grown, maxMoveNum);
+    }
+    else if (_maxSizes[index] < maxMoveNum * THREAD_CACHE_MAX_LIST_BATCHES)
+    {
+        // 热点尺寸类继续扩容, 超出线程预算时先从空闲尺寸类腾出额度
+        size_t growBytes = maxMoveNum * size;
+        if (CachedBytes() + growBytes > THREAD_CACHE_BUDGET)
+        {
+            Scavenge();
+        }
+        if (CachedBytes() + growBytes <= THREAD_CACHE_BUDGET)
+        {
+            _maxSizes[index] += maxMoveNum;
+        }
+    }
+    TickSlowPath();
+
+    void* start = nullptr;
+    void* end = nullptr;
+#if CMP_REMOTE_FREE
+    size_t actualNum = CentralCache::GetInstance()->FetchRangeObj(start, end, batchNum, size, this);
+#else
+    size_t actualNum = CentralCache::GetInstance()->FetchRangeObj(start, end, batchNum, size);
+#endif
+
+    if (actualNum == 0)
+    {
+        return nullptr;
+    }
+    if (actualNum == 1)
+    {
+        assert(start == end);
+        return start;
+    }
+    else
+    {
+        _freeLists[index].PushRange(NextObj(start), end, actualNum - 1);
+        return start;
+    }
+}
+
+void ThreadCache::Warm(size_t size)
+{
+    size = ClassBytes(size);
+    size_t index = SizeClass::Index(size);
+    size_t batchNum = SizeClass::NumMoveSize(size);
+    // 上限与链表长度相等时下一次释放就会还回一批, 所以留出一批的余量
+    _maxSizes[index] = std::max(_maxSizes[index], 2 * batchNum);
+
+    FreeList &list = _freeLists[index];
+    if (list.Size() >= batchNum)
+    {
+        return;
+    }
+    if (CachedBytes() + (batchNum - list.Size()) * size > THREAD_CACHE_BUDGET)
+    {
+        return;
+    }
+
+    // 中心缓存一次可能只给出 span 末尾剩下的几个对象, 取到一批或取不到为止
+    while (list.Size() < batchNum)
+    {
+        void *start = nullptr;
+        void *end = nullptr;
+#if CMP_REMOTE_FREE
+        size_t actualNum = CentralCache::GetInstance()->FetchRangeObj(start, end, batchNum - list.Size(), size, this);
+#else
+        size_t actualNum = CentralCache::GetInstance()->FetchRangeObj(start, end, batchNum - list.Size(), size);
+#endif
+        if (actualNum == 0)
+        {
+            return;
+        }
+        list.PushRange(start, end, actualNum);
+    }
+}
+
+void ThreadCache::ReleaseAll()
+{
+    for (size_t i = 0; i < NFREELIST; ++i)
+    {
+#if CMP_REMOTE_FREE
+        DrainRemoteFrees(i);
+#endif
+        FreeList &list = _freeLists[i];
+        if (list.Empty())
+        {
+            continue;
+        }
+
+        size_t n = list.Size();
+        void *start = nullptr;
+        void *end = nullptr;
+        list.PopRange(start, end, n);
+        size_t size = PageCache::GetInstance()->MapObjectToSpan(start)->_objSize;
+        CentralCache::GetInstance()->ReleaseListToSpans(start, size, n);
+    }
+}
+
+void ThreadCache::Scavenge()
+{
+    for (size_t i = 0; i < NFREELIST; ++i)
+    {
+        FreeList &list = _freeLists[i];
+        size_t lowWater = list.LowWater();
+        if (lowWater > 0)
+        {
+            size_t dropNum = lowWater > 1 ? lowWater / 2 : 1;
+            void *start = nullptr;
+            void *end = nullptr;
+            list.PopRange(start, end, dropNum);
+            size_t size = PageCache::GetInstance()->MapObjectToSpan(start)->_objSize;
+            CentralCache::GetInstance()->ReleaseListToSpans(start, size, dropNum);
+        }
+
+        if (_stats[i]._underflows == 0 && _maxSizes[i] > 1 && !list.Empty())
+        {
+            size_t batch = SizeClass::NumMoveSize(PageCache::GetInstance()->MapObjectToSpan(list.Front())->_objSize);
+            _maxSizes[i] = _maxSizes[i] > batch ? _maxSizes[i] - batch : std::max(_maxSizes[i] / 2, (size_t)1);
+        }
+        _stats[i]._underflows = 0;
+        list.ResetLowWater();
+    }
+}
+
+size_t ThreadCache::CachedBytes()
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < NFREELIST; ++i)
+    {
+        if (!_freeLists[i].Empty())
+        {
+            bytes += _freeLists[i].Size() * PageCache::GetInstance()->MapObjectToSpan(_freeLists[i].Front())->_objSize;
+        }
+    }
+    return bytes;
+}
+
+void ThreadCache::TickSlowPath()
+{
+    if (++_slowPathCount % THREAD_CACHE_DECAY_INTERVAL == 0)
+    {
+        Scavenge();
+    }
+
+    // 其他线程触及了内存上限: 全部还回, 上限回到慢开始
+    uint64_t epoch = PageCache::GetInstance()->PressureEpoch();
+    if (CMP_UNLIKELY(epoch != _pressureEpoch))
+    {
+        _pressureEpoch = epoch;
+        ReleaseAll();
+        for (size_t i = 0; i < NFREELIST; ++i)
+        {
+            _maxSizes[i] = 1;
+        }
+    }
+}
+
+// 所有创建过的线程缓存, 只在创建线程缓存和 fork 时访问
+class ThreadCacheRegistry
+{
+public:
+    static ThreadCacheRegistry *GetInstance()
+    {
+        static ThreadCacheRegistry inst;
+        return &inst;
+    }
+
+    void Add(ThreadCache *cache)
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _caches.push_back(cache);
+    }
+
+    std::mutex _mtx;
+    std::vector<ThreadCache *> _caches;
+};
+
+#if CMP_REMOTE_FREE
+bool ThreadCache::PushToOwner(void *ptr, size_t index)
+{
+    // 基数树查找不加锁; owner 已退出 (孤儿) 时留在本线程, 避免对象滞留在无人消费的链表里
+    Span *span = PageCache::GetInstance()->MapObjectToSpan(ptr);
+    ThreadCache *owner = static_cast<ThreadCache *>(span->_owner.load(std::memory_order_relaxed));
+    if (owner != nullptr && owner != this && !owner->_orphaned.load(std::memory_order_acquire))
+    {
+        owner->PushRemoteFree(ptr, index);
+        return true;
+    }
+    return false;
+}
+
+void ThreadCache::PushRemoteFree(void *ptr, size_t index)
+{
+    void *head = _remoteFrees[index].load(std::memory_order_relaxed);
+    do
+    {
+        NextObj(ptr) = head;
+    } while (!_remoteFrees[index].compare_exchange_weak(head, ptr, std::memory_order_release, std::memory_order_relaxed));
+}
+
+bool ThreadCache::DrainRemoteFrees(size_t index)
+{
+    if (_remoteFrees[index].load(std::memory_order_relaxed) == nullptr)
+    {
+        return false;
+    }
+
+    void *start = _remoteFrees[index].exchange(nullptr, std::memory_order_acquire);
+    void *end = start;
+    size_t n = 1;
+    while (NextObj(end) != nullptr)
+    {
+        end = NextObj(end);
+        ++n;
+    }
+    _freeLists[index].PushRange(start, end, n);
+    return true;
+}
+
+// 已退出线程留下的缓存, 由新线程接管
+class OrphanThreadCaches
+{
+public:
+    static OrphanThreadCaches *GetInstance()
+    {
+        static OrphanThreadCaches inst;
+        return &inst;
+    }
+
+    void Push(ThreadCache *cache)
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _caches.push_back(cache);
+    }
+
+    ThreadCache *Pop()
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (_caches.empty())
+        {
+            return nullptr;
+        }
+        ThreadCache *cache = _caches.back();
+        _caches.pop_back();
+        return cache;
+    }
+
+    std::mutex _mtx;
+    std::vector<ThreadCache *> _caches;
+};
+
+// 线程退出时把缓存里的对象还给 CentralCache, 再把缓存交给孤儿列表
+struct ThreadCacheReleaser
+{
+    ThreadCache *_cache = nullptr;
+
+    ~ThreadCacheReleaser()
+    {
+        if (_cache == nullptr)
+        {
+            return;
+        }
+        _cache->_orphaned.store(true, std::memory_order_release);
+        _cache->ReleaseAll();
+        OrphanThreadCaches::GetInstance()->Push(_cache);
+        pTLSThreadCache = nullptr;
+    }
+};
+#endif
+
+ThreadCache *CreateThreadCache()
+{
+#if CMP_REMOTE_FREE
+    static thread_local ThreadCacheReleaser releaser;
+    ThreadCache *cache = OrphanThreadCaches::GetInstance()->Pop();
+    if (cache == nullptr)
+    {
+        cache = new ThreadCache;
+        ThreadCacheRegistry::GetInstance()->Add(cache);
+    }
+    cache->_orphaned.store(false, std::memory_order_release);
+    releaser._cache = cache;
+    return cache;
+#else
+    ThreadCache *cache = new ThreadCache;
+    ThreadCacheRegistry::GetInstance()->Add(cache);
+    return cache;
+#endif
+}
+
+void ThreadCachesLockForFork()
+{
+    ThreadCacheRegistry::GetInstance()->_mtx.lock();
+#if CMP_REMOTE_FREE
+    OrphanThreadCaches::GetInstance()->_mtx.lock();
+#endif
+}
+
+void ThreadCachesUnlockForFork()
+{
+#if CMP_REMOTE_FREE
+    OrphanThreadCaches::GetInstance()->_mtx.unlock();
+#endif
+    ThreadCacheRegistry::GetInstance()->_mtx.unlock();
+}
+
+// 子进程里只剩调用 fork 的线程. 其他线程 fork 时可能正在无锁的快路径上修改自己的自由链表,
+// 复制过来的缓存不一定一致, 里面的对象无法安全收回, 只能放弃 (与 tcmalloc 相同).
+// 登记表只保留当前线程和已在孤儿列表中的缓存; CMP_REMOTE_FREE 下放弃的缓存标记为孤儿,
+// span 仍指向它们, 子进程释放这些对象时留在本线程, 不会投递到无人消费的链表
+void ThreadCachesRebuildAfterFork()
+{
+    ThreadCacheRegistry *registry = ThreadCacheRegistry::GetInstance();
+    std::vector<ThreadCache *> caches;
+    caches.swap(registry->_caches);
+    for (size_t i = 0; i < caches.size(); ++i)
+    {
+        ThreadCache *cache = caches[i];
+#if CMP_REMOTE_FREE
+        std::vector<ThreadCache *> &orphans = OrphanThreadCaches::GetInstance()->_caches;
+        if (cache != pTLSThreadCache && std::find(orphans.begin(), orphans.end(), cache) == orphans.end())
+        {
+            cache->_orphaned.store(true, std::memory_order_release);
+            continue;
+        }
+        registry->_caches.push_back(cache);
+#else
+        if (cache == pTLSThreadCache)
+        {
+            registry->_caches.push_back(cache);
+        }
+#endif
+    }
+}
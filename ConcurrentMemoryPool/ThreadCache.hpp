@@ -1,94 +1,135 @@
 #pragma once
 #include "Common.hpp"
-#include "CentralCache.hpp"
 
+// CMP_REMOTE_FREE=1 时开启跨线程释放投递 (参考 mimalloc):
+// span 记录最近取走其对象的线程缓存 (owner), 其他线程释放该 span 的对象时
+// 不放进自己的自由链表, 而是压入 owner 对应尺寸类的无锁 MPSC 链表,
+// owner 在该尺寸类下一次走慢路径时整批取回. 生产者/消费者流水线中
+// 对象因此在生产者内部循环, 消费者的缓存不会膨胀, CentralCache 的锁竞争也随之减少.
+#ifndef CMP_REMOTE_FREE
+#define CMP_REMOTE_FREE 0
+#endif
+
+// 线程缓存的自适应大小 (参考 tcmalloc 的 ThreadCache), 按尺寸类统计欠缺 (underflow) 和溢出 (overflow):
+// - 慢开始: 每次向中心缓存取对象, 链表上限翻倍直到一批 (NumMoveSize);
+//   之后仍然欠缺的热点尺寸类每次再加一批, 最多 THREAD_CACHE_MAX_LIST_BATCHES 批;
+// - 链表达到上限时还回一批, 上限超过一批的尺寸类每溢出 THREAD_CACHE_MAX_OVERAGES 次减一批;
+// - 每 THREAD_CACHE_DECAY_INTERVAL 次慢路径衰减一次: 各尺寸类还回低水位的一半,
+//   这段时间里没有欠缺过的尺寸类上限也减一批, 空闲的尺寸类不会一直占着内存;
+// - 热点尺寸类扩容时若整个线程缓存超过 THREAD_CACHE_BUDGET, 先衰减一次, 把空闲尺寸类的额度让出来;
+// - 堆触及内存上限 (见 MemoryLimit.hpp) 后, 每个线程缓存在下一次慢路径上全部还回并回到慢开始.
+static const size_t THREAD_CACHE_BUDGET = 2 * 1024 * 1024;
+static const size_t THREAD_CACHE_MAX_LIST_BATCHES = 4;
+static const size_t THREAD_CACHE_MAX_OVERAGES = 3;
+static const size_t THREAD_CACHE_DECAY_INTERVAL = 4096;
+
+// 每个尺寸类只在慢路径上访问的计数
+struct FreeListStats
+{
+    uint32_t _underflows = 0; // 本次衰减周期内向中心缓存取对象的次数
+    uint32_t _overages = 0;   // 上限超过一批后累计的溢出次数
+};
+
+// 头文件里只有分配/释放的快路径, 会内联进使用方; 与 CentralCache/PageCache 打交道的慢路径
+// 定义在 ThreadCache.cc, 使用方因此不需要包含下面几层的头文件
 class ThreadCache
 {
 public:
+    ThreadCache();
+
+    // 调用方保证 size <= THREAD_CACHE_MAX_BYTES
     void *Allocate(size_t size)
     {
-        assert(size <= THREAD_CACHE_MAX_BYTES);
-        size_t alignSize = SizeClass::RoundUp(size);
-        size_t index = SizeClass::Index(size);
-
-        if (!_freeLists[index].Empty())
-        {
-            return _freeLists[index].Pop();
-        }
-        else
+        size_t index = SizeClass::LookupIndex(size);
+        FreeList &list = _freeLists[index];
+        if (CMP_LIKELY(!list.Empty()))
         {
-            return FetchFromCentralCache(index, alignSize); //FetchFromCentralCache 是怎么实现的? 为什么要传入index和alignSzie?
+            return list.Pop();
         }
+        return AllocateSlow(index, size);
     }
 
+    // 调用方保证 ptr 非空且 size <= THREAD_CACHE_MAX_BYTES
     void Deallocate(void *ptr, size_t size)
     {
-        assert(ptr);
-        assert(size <= THREAD_CACHE_MAX_BYTES);
-
-        size_t index = SizeClass::Index(size);
-        _freeLists[index].Push(ptr);
+        size_t index = SizeClass::LookupIndex(size);
+#if CMP_REMOTE_FREE
+        if (PushToOwner(ptr, index))
+        {
+            return;
+        }
+#endif
+        FreeList &list = _freeLists[index];
+        list.Push(ptr);
 
         //当链表长度大于一次批量申请的内存时就开始还一段list给central cache
-        if (_freeLists[index].Size() >= _freeLists[index].MaxSize())
+        if (CMP_UNLIKELY(list.Size() >= _maxSizes[index]))
         {
-            ListTooLong(_freeLists[index], size);
+            ListTooLong(index, size);
         }
     }
 
-    void ListTooLong(FreeList& list, size_t size)
-    {
-        size_t returnNum = list.MaxSize() / 2;
-        if (returnNum == 0)
-        {
-            returnNum = 1;
-        }
+    CMP_NOINLINE void ListTooLong(size_t index, size_t size);
 
-        void* start = nullptr;
-        void* end = nullptr;
-        list.PopRange(start, end, returnNum);
+    // 超过硬上限取不到对象时返回 nullptr
+    CMP_NOINLINE void *FetchFromCentralCache(size_t index, size_t size);
 
-        CentralCache::GetInstance()->ReleaseListToSpans(start, size, returnNum);
-    }
+    // 把自由链表中的对象全部还给 CentralCache
+    void ReleaseAll();
 
-    void *FetchFromCentralCache(size_t index, size_t size)
+    // 衰减: 各尺寸类还回低水位的一半 (这些对象整个周期都没被用到),
+    // 周期内没有欠缺过的尺寸类上限减一批 (慢开始阶段减半)
+    void Scavenge();
+
+    // 预热 size 所在的尺寸类 (见 cmp::WarmThreadCache): 跳过慢开始, 链表上限直接调到两批,
+    // 再从中心缓存取满一批. 整个线程缓存会超过 THREAD_CACHE_BUDGET 时不取
+    void Warm(size_t size);
+
+    // 某个尺寸类当前缓存的对象数
+    size_t ListLength(size_t size)
     {
-        //慢开始反馈调节算法
-        size_t maxMoveNum = SizeClass::NumMoveSize(size);
-        size_t currentMaxSize = _freeLists[index].MaxSize();
-        size_t batchNum = std::min(currentMaxSize, maxMoveNum);
+        return _freeLists[SizeClass::LookupIndex(size)].Size();
+    }
 
-        if (_freeLists[index].MaxSize() < maxMoveNum)
-        {
-            size_t grown = _freeLists[index].MaxSize() * 2;
-            _freeLists[index].MaxSize() = std::min(grown, maxMoveNum);
-        }
+    // 当前缓存的总字节数, 只在慢路径上按需计算
+    size_t CachedBytes();
 
-        void* start = nullptr;
-        void* end = nullptr;
-        size_t actualNum = CentralCache::GetInstance()->FetchRangeObj(start, end, batchNum, size);
+#if CMP_REMOTE_FREE
+    // span 属于其他仍在运行的线程缓存时投递过去, 返回 true; 否则由本线程缓存收下
+    CMP_NOINLINE bool PushToOwner(void *ptr, size_t index);
 
-        assert(actualNum > 0); 
+    // 其他线程调用: 无锁压入 owner 的 MPSC 链表
+    void PushRemoteFree(void *ptr, size_t index);
 
-        if (actualNum == 1)
-        {
-            assert(start == end);
-            return start;
-        }
-        else
-        {
-            _freeLists[index].PushRange(NextObj(start), end, actualNum - 1);
-            return start;
-        }
-    }
+    // owner 线程调用: 一次取走整条链表放进自由链表
+    bool DrainRemoteFrees(size_t index);
+
+    // 线程退出后缓存不销毁, 而是标记为孤儿等待新线程接管,
+    // 这样退出后才到达的远程释放也不会丢失
+    std::atomic<bool> _orphaned{false};
+#endif
 
 private:
+    // 自由链表为空: 先收远程释放, 再向中心缓存批量取
+    CMP_NOINLINE void *AllocateSlow(size_t index, size_t size);
+
+    void TickSlowPath();
+
+    // 热数据: 每个尺寸类 16 字节, 一条缓存行放 4 个尺寸类
     FreeList _freeLists[NFREELIST];
+    // 链表长度上限, 释放时比较
+    size_t _maxSizes[NFREELIST];
+    // 冷数据: 只在慢路径上访问
+    FreeListStats _stats[NFREELIST];
+    size_t _slowPathCount = 0;
+    uint64_t _pressureEpoch = 0; // 最近一次响应过的 PageCache::PressureEpoch
+#if CMP_REMOTE_FREE
+    std::atomic<void *> _remoteFrees[NFREELIST];
+#endif
 };
 
-#ifdef _WIN32
-static _declspec(thread) ThreadCache *pTLSThreadCache = nullptr;
-#else
-static thread_local ThreadCache *pTLSThreadCache = nullptr;
-#endif
- 
+// 定义在 ThreadCache.cc, 所有翻译单元共用同一个线程缓存
+extern CMP_TLS ThreadCache *pTLSThreadCache;
+
+// 创建当前线程的缓存; CMP_REMOTE_FREE 模式下优先接管已退出线程的缓存. 只在线程首次分配时调用, 不内联
+ThreadCache *CreateThreadCache();
@@ -4,6 +4,20 @@
 
 #include "CentralCache.hpp"
 
+#include "ConcurrentObjectPool.hpp"
+
+#include "Arena.hpp"
+
+#include "MemoryLimit.hpp"
+
+#include "Prewarm.hpp"
+
+#ifndef _WIN32
+#include <csignal>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 void Alloc1()
 {
     for (size_t i = 0; i < 5; i++)
@@ -59,11 +73,488 @@ void TLSTest()
     t2.join();
 }
 
+struct PoolNode
+{
+    int _val;
+    PoolNode *_next;
+
+    explicit PoolNode(int val) : _val(val), _next(nullptr) {}
+};
+
+void TestConcurrentObjectPool()
+{
+    cmp::ConcurrentObjectPool<PoolNode> *pool = cmp::ConcurrentObjectPool<PoolNode>::GetInstance();
+
+    std::vector<PoolNode *> nodes;
+    for (int i = 0; i < 10000; i++)
+    {
+        nodes.push_back(pool->New(i));
+    }
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        assert(nodes[i]->_val == (int)i);
+        pool->Delete(nodes[i]);
+    }
+
+    // 其它线程释放本线程申请的对象
+    nodes.clear();
+    for (int i = 0; i < 1000; i++)
+    {
+        nodes.push_back(pool->New(i));
+    }
+    std::thread t([&nodes, pool]()
+                  {
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            pool->Delete(nodes[i]);
+        } });
+    t.join();
+
+    {
+        auto up = cmp::MakePooled<PoolNode>(7);
+        assert(up->_val == 7);
+    }
+
+    pool->FlushThreadMagazines();
+    size_t before = pool->ChunkBytes();
+    size_t trimmed = pool->Trim();
+    cout << "chunk bytes: " << before << ", trimmed: " << trimmed
+         << ", left: " << pool->ChunkBytes() << endl;
+}
+
+void TestArena()
+{
+    cmp::Arena arena;
+    int *head = arena.New<int>(1);
+
+    cmp::Arena::Checkpoint cp = arena.Mark();
+    {
+        cmp::ArenaScope scope(arena);
+        std::vector<int, cmp::ArenaAllocator<int>> values{cmp::ArenaAllocator<int>(arena)};
+        for (int i = 0; i < 100000; i++)
+        {
+            values.push_back(i);
+        }
+        std::string *str = arena.New<std::string>(100, 'x');
+        assert(str->size() == 100);
+        cout << "arena spans: " << arena.SpanCount() << ", reserved: " << arena.BytesReserved() << endl;
+    }
+    assert(arena.SpanCount() == 1);
+    assert(*head == 1);
+
+    arena.Allocate(512 * 1024);
+    arena.Rewind(cp);
+    assert(arena.SpanCount() == 1);
+
+    arena.Reset();
+    assert(arena.SpanCount() == 0 && arena.BytesAllocated() == 0);
+}
+
+void PrintOccupancy(const CentralOccupancy &occ)
+{
+    cout << "spans by occupancy:";
+    for (size_t b = 0; b <= CENTRAL_OCCUPANCY_BUCKETS; b++)
+    {
+        cout << " " << occ._spans[b];
+    }
+    cout << ", live " << occ._useObjs << "/" << occ._capacityObjs << endl;
+}
+
+void TestCentralOccupancy()
+{
+    const size_t size = 1024;
+    std::vector<void *> objs;
+    for (size_t i = 0; i < 2048; i++)
+    {
+        void *start = nullptr;
+        void *end = nullptr;
+        CentralCache::GetInstance()->FetchRangeObj(start, end, 1, size);
+        objs.push_back(start);
+    }
+
+    // 每 32 个留一个, 其余逐个还回去, 造成大量稀疏 span
+    for (size_t i = 0; i < objs.size(); i++)
+    {
+        if (i % 32 != 0)
+        {
+            NextObj(objs[i]) = nullptr;
+            CentralCache::GetInstance()->ReleaseListToSpans(objs[i], size, 1);
+        }
+    }
+    CentralOccupancy before = CentralCache::GetInstance()->GetOccupancy(size);
+    PrintOccupancy(before);
+
+    CentralCache::GetInstance()->ReleaseSparseSpans();
+    CentralOccupancy after = CentralCache::GetInstance()->GetOccupancy(size);
+    PrintOccupancy(after);
+    assert(after._useObjs <= before._useObjs);
+
+    for (size_t i = 0; i < objs.size(); i += 32)
+    {
+        NextObj(objs[i]) = nullptr;
+        CentralCache::GetInstance()->ReleaseListToSpans(objs[i], size, 1);
+    }
+    CentralCache::GetInstance()->ReleaseSparseSpans();
+}
+
+void TestLargeSpan()
+{
+    // 超过 NPAGES - 1 页的对象也从 PageCache 取
+    void *big = ConcurrentAlloc(4 * 1024 * 1024);
+    void *mid = ConcurrentAlloc(300 * 1024);
+    Span *span = PageCache::GetInstance()->MapObjectToSpan(big);
+    assert(span->_n == (4 * 1024 * 1024) >> PAGE_SHIFT);
+    assert(PageCache::GetInstance()->MapObjectToSpan((char *)big + 3 * 1024 * 1024) == span);
+    ConcurrentFree(big, 4 * 1024 * 1024);
+
+    // 释放后与相邻空闲 span 合并, 再申请同样大小时取地址最低的最佳匹配, 不会比原地址更高
+    void *again = ConcurrentAlloc(4 * 1024 * 1024);
+    assert(again <= big);
+    ConcurrentFree(again, 4 * 1024 * 1024);
+    ConcurrentFree(mid, 300 * 1024);
+}
+
+void TestCalloc()
+{
+    assert(ConcurrentCalloc((size_t)-1 / 2, 4) == nullptr);
+
+    // 小对象: 先写脏再释放, 再次申请到同一块时也必须是零
+    char *small = (char *)ConcurrentAlloc(100);
+    memset(small, 0xff, 100);
+    ConcurrentFree(small, 100);
+    char *zeroSmall = (char *)ConcurrentCalloc(10, 10);
+    for (size_t i = 0; i < 100; i++)
+    {
+        assert(zeroSmall[i] == 0);
+    }
+    ConcurrentFree(zeroSmall, 100);
+
+    // 大对象: 归还的 span 不再是零页, 需要 memset
+    const size_t bytes = 1024 * 1024;
+    char *big = (char *)ConcurrentAlloc(bytes);
+    memset(big, 0xff, bytes);
+    ConcurrentFree(big, bytes);
+    char *zeroBig = (char *)ConcurrentCalloc(bytes / 8, 8);
+    for (size_t i = 0; i < bytes; i += 4096)
+    {
+        assert(zeroBig[i] == 0 && zeroBig[i + 4095] == 0);
+    }
+    ConcurrentFree(zeroBig, bytes);
+}
+
+void TestThreadCacheDecay()
+{
+    std::thread t([]() {
+        // 一次性申请再全部释放, 1024 字节的尺寸类在线程缓存里攒下一批对象
+        std::vector<void *> objs;
+        for (size_t i = 0; i < 1000; i++)
+        {
+            objs.push_back(ConcurrentAlloc(1024));
+        }
+        for (size_t i = 0; i < objs.size(); i++)
+        {
+            ConcurrentFree(objs[i], 1024);
+        }
+        size_t before = pTLSThreadCache->ListLength(1024);
+
+        // 之后只使用其他尺寸类, 慢路径上的周期衰减会逐步还回空闲尺寸类的对象
+        for (size_t round = 0; round < 20000; round++)
+        {
+            size_t size = 16 + (round % 64) * 128;
+            void *a[64];
+            for (size_t i = 0; i < 64; i++)
+            {
+                a[i] = ConcurrentAlloc(size);
+            }
+            for (size_t i = 0; i < 64; i++)
+            {
+                ConcurrentFree(a[i], size);
+            }
+        }
+        size_t after = pTLSThreadCache->ListLength(1024);
+        cout << "idle 1024B list before/after decay: " << before << "/" << after
+             << ", thread cache bytes: " << pTLSThreadCache->CachedBytes() << endl;
+        assert(after < before);
+    });
+    t.join();
+}
+
+void TestMemoryLimit()
+{
+    static size_t pressureCalls[2] = {0, 0};
+    int id = cmp::AddMemoryPressureCallback([](cmp::MemoryPressure level, void *) { pressureCalls[(int)level]++; }, nullptr);
+
+    // 软上限紧贴当前占用, 硬上限只多留 16MB: 持续申请 1MB 的对象, 最终返回 nullptr 而不是继续映射
+    const size_t bytes = 1024 * 1024;
+    size_t base = cmp::HeapBytes();
+    cmp::SetMemoryLimits(base + bytes, base + 16 * bytes);
+    std::vector<void *> objs;
+    for (size_t i = 0; i < 256; i++)
+    {
+        void *p = ConcurrentAlloc(bytes);
+        if (p == nullptr)
+        {
+            break;
+        }
+        objs.push_back(p);
+    }
+    size_t heap = cmp::HeapBytes();
+    cout << "objects under hard limit: " << objs.size() << ", heap bytes: " << heap
+         << ", soft/hard callbacks: " << pressureCalls[0] << "/" << pressureCalls[1] << endl;
+    assert(objs.size() < 256);
+    assert(heap <= base + 16 * bytes);
+    assert(pressureCalls[(int)cmp::MemoryPressure::kSoft] > 0);
+    assert(pressureCalls[(int)cmp::MemoryPressure::kHard] > 0);
+
+    for (size_t i = 0; i < objs.size(); i++)
+    {
+        ConcurrentFree(objs[i], bytes);
+    }
+    cmp::SetMemoryLimits(0, 0);
+    cmp::RemoveMemoryPressureCallback(id);
+    void *big = ConcurrentAlloc(64 * bytes);
+    assert(big != nullptr);
+    ConcurrentFree(big, 64 * bytes);
+}
+
+void TestReleaseFreeMemory()
+{
+    // 一次突发分配后全部释放, 主动归还后空闲页应当还给系统
+    std::vector<void *> objs;
+    for (size_t i = 0; i < 4096; i++)
+    {
+        objs.push_back(ConcurrentAlloc(4096));
+    }
+    void *big = ConcurrentAlloc(8 * 1024 * 1024);
+    for (size_t i = 0; i < objs.size(); i++)
+    {
+        ConcurrentFree(objs[i], 4096);
+    }
+    ConcurrentFree(big, 8 * 1024 * 1024);
+
+    size_t before = cmp::HeapBytes();
+    cmp::FlushThreadCache();
+    size_t released = cmp::ReleaseFreeMemory();
+    size_t after = cmp::HeapBytes();
+    cout << "heap bytes before/after release: " << before << "/" << after << ", released: " << released << endl;
+    assert(released >= 8 * 1024 * 1024);
+    assert(after + released == before);
+
+    // 已释放的页再次分配可以正常使用
+    char *p = (char *)ConcurrentAlloc(8 * 1024 * 1024);
+    p[0] = 1;
+    p[8 * 1024 * 1024 - 1] = 1;
+    ConcurrentFree(p, 8 * 1024 * 1024);
+    assert(cmp::TrimTo(0) <= after);
+}
+
+void TestPrewarm()
+{
+    // 预留的页作为空闲 span 计入堆占用, 之后的 span 从中切分
+    size_t before = cmp::HeapBytes();
+    assert(cmp::ReserveHeap(16 * 1024 * 1024, true));
+    assert(cmp::HeapBytes() >= before + 16 * 1024 * 1024);
+
+    std::vector<size_t> sizes = {100, 1000, 8 * 1024, 1024 * 1024};
+    size_t filled = cmp::PrewarmCentralCache(sizes);
+    cout << "prewarmed central cache objects: " << filled << endl;
+#if !(defined(CMP_SHARDED_ENGINE) && CMP_SHARDED_ENGINE)
+    assert(filled > 0);
+#endif
+
+    std::thread t([&sizes]() {
+        cmp::WarmThreadCache(sizes);
+#if !(defined(CMP_SHARDED_ENGINE) && CMP_SHARDED_ENGINE)
+        // 新线程的第一次分配直接命中自由链表
+        assert(pTLSThreadCache->ListLength(100) == SizeClass::NumMoveSize(SizeClass::RoundUp(100)));
+        assert(pTLSThreadCache->ListLength(8 * 1024) == SizeClass::NumMoveSize(8 * 1024));
+#endif
+        void *p = ConcurrentAlloc(1000);
+        memset(p, 0, 1000);
+        ConcurrentFree(p, 1000);
+    });
+    t.join();
+}
+
+#ifndef _WIN32
+void TestFork()
+{
+    // 另一个线程持续走中心缓存和页缓存, fork 时这些锁可能正被持有, 子进程里的分配不能死锁
+    std::atomic<bool> stop(false);
+    std::thread worker([&stop]() {
+        while (!stop)
+        {
+            void *big = ConcurrentAlloc(300 * 1024);
+            ConcurrentFree(big, 300 * 1024);
+            cmp::ReleaseFreeMemory();
+        }
+    });
+    for (int i = 0; i < 20; i++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            std::thread child([]() {
+                void *p = ConcurrentAlloc(1024);
+                void *big = ConcurrentAlloc(1024 * 1024);
+                ConcurrentFree(p, 1024);
+                ConcurrentFree(big, 1024 * 1024);
+            });
+            child.join();
+            _exit(0);
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    stop = true;
+    worker.join();
+}
+
+#if CMP_HARDENED || CMP_GUARDED_SAMPLING
+// 在子进程里执行 body, 期望被信号 sig 终止
+template <class Body>
+void ExpectSignal(int sig, Body body)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // 不把预期中的报错打到测试输出里
+        freopen("/dev/null", "w", stderr);
+        body();
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == sig);
+}
+#endif
+
+#if CMP_HARDENED
+void TestHardened()
+{
+    // 正常的分配释放不受影响
+    void *ok = ConcurrentAlloc(24);
+    ConcurrentFree(ok, 24);
+
+    ExpectSignal(SIGABRT, []() {
+        void *p = ConcurrentAlloc(64);
+        ConcurrentFree(p, 64);
+        ConcurrentFree(p, 64);
+    });
+    ExpectSignal(SIGABRT, []() {
+        void *p = ConcurrentAlloc(64);
+        ConcurrentFree(p, 1024);
+    });
+    ExpectSignal(SIGABRT, []() {
+        void *p = ConcurrentAlloc(64);
+        ConcurrentFree((char *)p + 16, 48);
+    });
+    ExpectSignal(SIGABRT, []() {
+        void *big = ConcurrentAlloc(1024 * 1024);
+        ConcurrentFree(big, 512 * 1024);
+    });
+    ExpectSignal(SIGABRT, []() {
+        static char notFromPool[64];
+        ConcurrentFree(notFromPool, 64);
+    });
+    // use-after-free 改写了自由链表里 p 的 next 指针, 再次取出 p 时发现
+    ExpectSignal(SIGABRT, []() {
+        void *p = ConcurrentAlloc(128);
+        ConcurrentFree(p, 128);
+        *(uintptr_t *)p ^= 1;
+        ConcurrentAlloc(128);
+    });
+#if CMP_HARDENED_REDZONE_INTERVAL
+    ExpectSignal(SIGABRT, []() {
+        for (int i = 0; i < CMP_HARDENED_REDZONE_INTERVAL; i++)
+        {
+            char *p = (char *)ConcurrentAlloc(20);
+            p[20] = 0;
+            ConcurrentFree(p, 20);
+        }
+    });
+#endif
+}
+#endif
+#if CMP_GUARDED_SAMPLING
+void TestGuardedSampling()
+{
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t rate = cmp::GetGuardedSampleRate();
+    cmp::SetGuardedSampleRate(1);
+
+    // 每次分配都抽中: 对象贴着槽位末尾, 后面就是保护页
+    char *p = (char *)ConcurrentAlloc(24);
+    assert(cmp::guarded::Owns(p) && ((uintptr_t)p + 24) % pageSize == 0);
+    memset(p, 1, 24);
+    assert(cmp::GuardedAllocationsInUse() == 1);
+    ConcurrentFree(p, 24);
+    assert(cmp::GuardedAllocationsInUse() == 0);
+
+    // 超过一个系统页的对象照常分配
+    void *big = ConcurrentAlloc(pageSize + 1);
+    assert(!cmp::guarded::Owns(big));
+    ConcurrentFree(big, pageSize + 1);
+
+    // 槽位用尽后照常分配
+    std::vector<void *> objs;
+    for (size_t i = 0; i <= GUARDED_SLOTS; i++)
+    {
+        objs.push_back(ConcurrentAlloc(64));
+    }
+    assert(cmp::guarded::Owns(objs[GUARDED_SLOTS - 1]) && !cmp::guarded::Owns(objs[GUARDED_SLOTS]));
+    for (size_t i = 0; i < objs.size(); i++)
+    {
+        ConcurrentFree(objs[i], 64);
+    }
+
+    ExpectSignal(SIGSEGV, []() {
+        char *q = (char *)ConcurrentAlloc(24);
+        q[24] = 0;
+    });
+    ExpectSignal(SIGSEGV, []() {
+        char *q = (char *)ConcurrentAlloc(24);
+        ConcurrentFree(q, 24);
+        q[0] = 0;
+    });
+    ExpectSignal(SIGABRT, []() {
+        void *q = ConcurrentAlloc(24);
+        ConcurrentFree(q, 24);
+        ConcurrentFree(q, 24);
+    });
+
+    cmp::SetGuardedSampleRate(rate);
+}
+#endif
+#endif
+
 int main()
 {
     // TestObjectPool();
     // TLSTest();
     // TestConcurrentAlloc();
     TestConcurrentAlloc2();
+    TestConcurrentObjectPool();
+    TestArena();
+    TestCentralOccupancy();
+    TestLargeSpan();
+    TestCalloc();
+#if !(defined(CMP_SHARDED_ENGINE) && CMP_SHARDED_ENGINE)
+    // 分片引擎不经过 ThreadCache
+    TestThreadCacheDecay();
+#endif
+    TestMemoryLimit();
+    TestReleaseFreeMemory();
+    TestPrewarm();
+#ifndef _WIN32
+    TestFork();
+#if CMP_HARDENED
+    TestHardened();
+#endif
+#if CMP_GUARDED_SAMPLING
+    TestGuardedSampling();
+#endif
+#endif
     return 0;
 }
@@ -0,0 +1,328 @@
+#pragma once
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#if defined(__GLIBC__) || defined(__linux__)
+#include <malloc.h>
+#endif
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+#include "AllocatorWrapper.hpp"
+#include "CentralCache.hpp"
+#include "ConcurrentAlloc.hpp"
+#include "ShardedHeap.hpp"
+
+// 基准测试使用的分配器插件表: 内存池自身的前端变体 + glibc malloc,
+// 以及运行时通过 dlopen 加载的 jemalloc/tcmalloc/mimalloc (机器上存在时才可用).
+// 任意共享库也可以用 dlopen:PATH[:ALLOC_SYM:FREE_SYM] 的形式指定.
+namespace bench
+{
+typedef void *(*AllocFn)(size_t);
+typedef void (*FreeFn)(void *, size_t);
+typedef size_t (*UsableSizeFn)(void *, size_t);
+
+struct AllocatorPlugin
+{
+    std::string name;
+    AllocFn alloc = nullptr;
+    FreeFn free = nullptr;
+    UsableSizeFn usable_size = nullptr; // 分配器为一次申请实际占用的字节数
+    bool is_pool = false;               // 是否为本内存池 (统计 SystemAlloc 映射量)
+    size_t max_size = 0;                // 0 表示不限制
+};
+
+inline void *PoolAlloc(size_t size)
+{
+    return ConcurrentAlloc(size);
+}
+
+inline void PoolFree(void *ptr, size_t size)
+{
+    ConcurrentFree(ptr, size);
+}
+
+inline size_t PoolUsableSize(void *, size_t size)
+{
+    if (size <= THREAD_CACHE_MAX_BYTES)
+    {
+        return SizeClass::RoundUp(size);
+    }
+    return ((size + ((size_t)1 << PAGE_SHIFT) - 1) >> PAGE_SHIFT) << PAGE_SHIFT;
+}
+
+// 经由 AllocatorWrapper 的前端, 衡量包装层本身的开销
+inline void *PoolWrapperAlloc(size_t size)
+{
+    return cmp::AllocateRaw<char>(size);
+}
+
+inline void PoolWrapperFree(void *ptr, size_t size)
+{
+    cmp::DeallocateRaw(static_cast<char *>(ptr), size);
+}
+
+// 按页分片的 ShardedHeap 引擎, 与 ThreadCache/CentralCache 对照
+inline void *PoolShardedAlloc(size_t size)
+{
+    return ShardedAlloc(size);
+}
+
+inline void PoolShardedFree(void *ptr, size_t size)
+{
+    ShardedFree(ptr, size);
+}
+
+inline void *MallocAlloc(size_t size)
+{
+    return std::malloc(size);
+}
+
+inline void MallocFree(void *ptr, size_t)
+{
+    std::free(ptr);
+}
+
+inline size_t MallocUsableSize(void *ptr, size_t size)
+{
+#if defined(__GLIBC__)
+    return ptr != nullptr ? malloc_usable_size(ptr) : size;
+#else
+    (void)ptr;
+    return size;
+#endif
+}
+
+// 每个进程只测一个分配器, dlopen 得到的符号放在全局, 由下面的跳板函数转发
+struct DynamicSymbols
+{
+    void *(*alloc)(size_t) = nullptr;
+    void (*free)(void *) = nullptr;
+    void (*sized_free)(void *, size_t) = nullptr;
+    void (*sized_free_flags)(void *, size_t, int) = nullptr; // jemalloc sdallocx
+    size_t (*usable)(void *) = nullptr;
+};
+
+static DynamicSymbols g_dynamic;
+
+inline void *DynamicAlloc(size_t size)
+{
+    return g_dynamic.alloc(size);
+}
+
+inline void DynamicFree(void *ptr, size_t size)
+{
+    if (g_dynamic.sized_free != nullptr)
+    {
+        g_dynamic.sized_free(ptr, size);
+    }
+    else if (g_dynamic.sized_free_flags != nullptr)
+    {
+        g_dynamic.sized_free_flags(ptr, size, 0);
+    }
+    else
+    {
+        g_dynamic.free(ptr);
+    }
+}
+
+inline size_t DynamicUsableSize(void *ptr, size_t size)
+{
+    return g_dynamic.usable != nullptr && ptr != nullptr ? g_dynamic.usable(ptr) : size;
+}
+
+struct DynamicCandidate
+{
+    const char *name;
+    const char *libs[4];
+    const char *alloc_sym;
+    const char *free_sym;
+    const char *sized_free_sym;
+    const char *sdallocx_sym;
+    const char *usable_sym;
+};
+
+static const DynamicCandidate kDynamicCandidates[] = {
+    {"jemalloc", {"libjemalloc.so.2", "libjemalloc.so", nullptr, nullptr},
+     "malloc", "free", nullptr, "sdallocx", "malloc_usable_size"},
+    {"tcmalloc", {"libtcmalloc_minimal.so.4", "libtcmalloc.so.4", "libtcmalloc_minimal.so", "libtcmalloc.so"},
+     "tc_malloc", "tc_free", "tc_free_sized", nullptr, "tc_malloc_size"},
+    {"mimalloc", {"libmimalloc.so.2", "libmimalloc.so", nullptr, nullptr},
+     "mi_malloc", "mi_free", "mi_free_size", nullptr, "mi_usable_size"},
+};
+
+#ifndef _WIN32
+template <class Fn>
+inline Fn LoadSymbol(void *handle, const char *sym)
+{
+    if (sym == nullptr)
+    {
+        return nullptr;
+    }
+    return reinterpret_cast<Fn>(dlsym(handle, sym));
+}
+
+inline void *OpenLibrary(const DynamicCandidate &candidate)
+{
+    for (size_t i = 0; i < 4 && candidate.libs[i] != nullptr; ++i)
+    {
+        // RTLD_LOCAL: 不让被测分配器替换进程里其它代码的 malloc
+        void *handle = dlopen(candidate.libs[i], RTLD_NOW | RTLD_LOCAL);
+        if (handle != nullptr)
+        {
+            return handle;
+        }
+    }
+    return nullptr;
+}
+
+inline bool LoadDynamic(void *handle, const DynamicCandidate &candidate, DynamicSymbols &syms)
+{
+    syms.alloc = LoadSymbol<void *(*)(size_t)>(handle, candidate.alloc_sym);
+    syms.free = LoadSymbol<void (*)(void *)>(handle, candidate.free_sym);
+    syms.sized_free = LoadSymbol<void (*)(void *, size_t)>(handle, candidate.sized_free_sym);
+    syms.sized_free_flags = LoadSymbol<void (*)(void *, size_t, int)>(handle, candidate.sdallocx_sym);
+    syms.usable = LoadSymbol<size_t (*)(void *)>(handle, candidate.usable_sym);
+    return syms.alloc != nullptr && syms.free != nullptr;
+}
+#endif
+
+inline std::vector<AllocatorPlugin> BuiltinAllocators()
+{
+    std::vector<AllocatorPlugin> plugins(4);
+    plugins[0].name = "pool";
+    plugins[0].alloc = PoolAlloc;
+    plugins[0].free = PoolFree;
+    plugins[0].usable_size = PoolUsableSize;
+    plugins[0].is_pool = true;
+    plugins[0].max_size = MAX_BYTES;
+
+    plugins[1].name = "pool-wrapper";
+    plugins[1].alloc = PoolWrapperAlloc;
+    plugins[1].free = PoolWrapperFree;
+    plugins[1].usable_size = PoolUsableSize;
+    plugins[1].is_pool = true;
+    plugins[1].max_size = MAX_BYTES;
+
+    plugins[2].name = "pool-sharded";
+    plugins[2].alloc = PoolShardedAlloc;
+    plugins[2].free = PoolShardedFree;
+    plugins[2].usable_size = PoolUsableSize;
+    plugins[2].is_pool = true;
+    plugins[2].max_size = MAX_BYTES;
+
+    plugins[3].name = "malloc";
+    plugins[3].alloc = MallocAlloc;
+    plugins[3].free = MallocFree;
+    plugins[3].usable_size = MallocUsableSize;
+    return plugins;
+}
+
+// 解析分配器名字并准备好插件; 失败时返回 false 并给出原因
+inline bool ResolveAllocator(const std::string &name, AllocatorPlugin &plugin, std::string &error)
+{
+    std::vector<AllocatorPlugin> builtins = BuiltinAllocators();
+    for (size_t i = 0; i < builtins.size(); ++i)
+    {
+        if (builtins[i].name == name)
+        {
+            plugin = builtins[i];
+            return true;
+        }
+    }
+
+#ifndef _WIN32
+    DynamicCandidate candidate = {nullptr, {nullptr, nullptr, nullptr, nullptr},
+                                  "malloc", "free", nullptr, nullptr, "malloc_usable_size"};
+    std::string custom_lib;
+    std::string custom_alloc;
+    std::string custom_free;
+    if (name.rfind("dlopen:", 0) == 0)
+    {
+        // dlopen:PATH[:ALLOC_SYM:FREE_SYM]
+        std::string spec = name.substr(7);
+        size_t p1 = spec.find(':');
+        custom_lib = spec.substr(0, p1);
+        if (p1 != std::string::npos)
+        {
+            size_t p2 = spec.find(':', p1 + 1);
+            if (p2 == std::string::npos)
+            {
+                error = "Expected dlopen:PATH:ALLOC_SYM:FREE_SYM: " + name;
+                return false;
+            }
+            custom_alloc = spec.substr(p1 + 1, p2 - p1 - 1);
+            custom_free = spec.substr(p2 + 1);
+            candidate.alloc_sym = custom_alloc.c_str();
+            candidate.free_sym = custom_free.c_str();
+            candidate.usable_sym = nullptr;
+        }
+        candidate.name = name.c_str();
+        candidate.libs[0] = custom_lib.c_str();
+    }
+    else
+    {
+        for (size_t i = 0; i < sizeof(kDynamicCandidates) / sizeof(kDynamicCandidates[0]); ++i)
+        {
+            if (name == kDynamicCandidates[i].name)
+            {
+                candidate = kDynamicCandidates[i];
+            }
+        }
+    }
+
+    if (candidate.name != nullptr)
+    {
+        void *handle = OpenLibrary(candidate);
+        if (handle == nullptr)
+        {
+            error = "Allocator library not found for " + name;
+            return false;
+        }
+        if (!LoadDynamic(handle, candidate, g_dynamic))
+        {
+            error = "Missing allocation symbols in library for " + name;
+            return false;
+        }
+
+        plugin.name = name;
+        plugin.alloc = DynamicAlloc;
+        plugin.free = DynamicFree;
+        plugin.usable_size = DynamicUsableSize;
+        return true;
+    }
+#endif
+
+    error = "Unsupported allocator: " + name;
+    return false;
+}
+
+// 当前机器上可用的分配器 (内置 + 能 dlopen 到的)
+inline std::vector<std::string> AvailableAllocators()
+{
+    std::vector<std::string> names;
+    std::vector<AllocatorPlugin> builtins = BuiltinAllocators();
+    for (size_t i = 0; i < builtins.size(); ++i)
+    {
+        names.push_back(builtins[i].name);
+    }
+
+#ifndef _WIN32
+    for (size_t i = 0; i < sizeof(kDynamicCandidates) / sizeof(kDynamicCandidates[0]); ++i)
+    {
+        void *handle = OpenLibrary(kDynamicCandidates[i]);
+        if (handle != nullptr)
+        {
+            names.push_back(kDynamicCandidates[i].name);
+            dlclose(handle);
+        }
+    }
+#endif
+    return names;
+}
+
+} // namespace bench
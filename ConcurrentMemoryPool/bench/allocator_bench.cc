@@ -4,6 +4,7 @@
 #include <climits>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -11,7 +12,7 @@
 #include <utility>
 #include <vector>
 
-#include "ConcurrentAlloc.hpp"
+#include "BenchAllocators.hpp"
 
 namespace
 {
@@ -20,9 +21,11 @@ using SystemClock = std::chrono::system_clock;
 
 struct Config
 {
-    std::string allocator = "pool";      // pool | malloc
-    std::string mode = "immediate";      // immediate | window
+    std::string allocator = "pool";      // see --list-allocators
+    std::string mode = "immediate";      // immediate | window | pipeline
     std::string size_dist = "fixed";     // fixed | mixed
+    std::string touch = "first";         // first | all (bytes written per allocation)
+    std::string free_order = "fifo";     // fifo | random (window mode: which live object is freed)
     std::string csv_path;                // optional
     std::string label = "default";       // optional scenario label
     size_t threads = 1;
@@ -31,6 +34,71 @@ struct Config
     size_t sample_rate = 1024;           // one latency sample every N ops
     int warmup_seconds = 2;
     int measure_seconds = 10;
+    size_t rss_interval_ms = 50;         // RSS sampling period
+    bench::AllocatorPlugin plugin;       // resolved from allocator
+};
+
+// 每个 worker 当前存活对象的字节数, 由 worker 写、采样线程读, 按缓存行隔开
+struct alignas(64) LiveBytes
+{
+    std::atomic<int64_t> requested{0};
+    std::atomic<int64_t> held{0};
+};
+
+// pipeline 模式下相邻 worker 之间的单生产者单消费者队列:
+// worker i 把分配的对象交给 worker i+1 释放, 模拟生产者/消费者流水线的跨线程释放
+struct alignas(64) Handoff
+{
+    std::vector<void *> ptrs;
+    std::vector<size_t> sizes;
+    alignas(64) std::atomic<size_t> head{0}; // consumer
+    alignas(64) std::atomic<size_t> tail{0}; // producer
+
+    void Init(size_t capacity)
+    {
+        ptrs.assign(capacity, nullptr);
+        sizes.assign(capacity, 0);
+    }
+
+    bool TryPush(void *ptr, size_t size)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == ptrs.size())
+        {
+            return false;
+        }
+        ptrs[t % ptrs.size()] = ptr;
+        sizes[t % ptrs.size()] = size;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(void *&ptr, size_t &size)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        ptr = ptrs[h % ptrs.size()];
+        size = sizes[h % ptrs.size()];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+struct MemorySummary
+{
+    uint64_t baseline_rss_bytes = 0;     // before workers start
+    uint64_t peak_rss_bytes = 0;         // max over warmup + measure
+    uint64_t steady_rss_bytes = 0;       // mean over measure phase
+    uint64_t live_requested_bytes = 0;   // mean live bytes asked for by the workload
+    uint64_t live_held_bytes = 0;        // mean live bytes after allocator rounding
+    uint64_t mapped_bytes = 0;           // mapped through SystemAlloc (pool only)
+    double internal_frag = 0.0;          // (held - requested) / held
+    double external_frag = 0.0;          // (rss_growth - held) / rss_growth
+    double overhead_per_live_byte = 0.0; // (steady_rss - baseline_rss) / requested
+    size_t samples = 0;
 };
 
 struct WorkerStats
@@ -63,10 +131,14 @@ struct BenchmarkResult
     double ops_per_sec = 0.0;
     LatencySummary alloc_latency;
     LatencySummary free_latency;
+    MemorySummary memory;
+    LockStats page_lock;      // pool only, whole run including warmup
+    LockStats span_locks;     // summed over all size classes
+    LockStats transfer_locks; // summed over all size classes
 };
 
-typedef void *(*AllocFn)(size_t);
-typedef void (*FreeFn)(void *, size_t);
+using bench::AllocFn;
+using bench::FreeFn;
 
 static uint64_t XorShift64(uint64_t &state)
 {
@@ -117,20 +189,31 @@ static void PrintUsage(const char *prog)
     std::cout
         << "Usage:\n"
         << "  " << prog
-        << " [--allocator=pool|malloc]"
+        << " [--allocator=NAME]"
         << " [--threads=N]"
         << " [--size=BYTES]"
         << " [--size-dist=fixed|mixed]"
-        << " [--mode=immediate|window]"
+        << " [--mode=immediate|window|pipeline]"
         << " [--window=N]"
+        << " [--free-order=fifo|random]"
         << " [--warmup=SECONDS]"
         << " [--seconds=SECONDS]"
         << " [--sample-rate=N]"
+        << " [--touch=first|all]"
+        << " [--rss-interval-ms=N]"
         << " [--label=NAME]"
-        << " [--csv=/path/file.csv]\n\n"
+        << " [--csv=/path/file.csv]\n"
+        << "  " << prog << " --list-allocators\n\n"
+        << "Allocators: pool, pool-wrapper, pool-sharded, malloc, jemalloc, tcmalloc, mimalloc\n"
+        << "  (the last three are loaded with dlopen when installed),\n"
+        << "  or dlopen:PATH[:ALLOC_SYM:FREE_SYM] for any other shared library.\n\n"
         << "Examples:\n"
         << "  " << prog << " --allocator=pool --threads=8 --size=64 --seconds=10\n"
-        << "  " << prog << " --allocator=malloc --threads=8 --size-dist=mixed --mode=window --window=4096\n";
+        << "  " << prog << " --allocator=malloc --threads=8 --size-dist=mixed --mode=window --window=4096\n"
+        << "  " << prog << " --allocator=pool --threads=4 --mode=pipeline --window=1024\n\n"
+        << "pipeline: worker i hands each object to worker i+1 (queue depth --window), which frees it.\n"
+        << "window --free-order=random: each allocation replaces a random live object, so with a large\n"
+        << "  window the free lists hold objects in random address order and go cold between reuses.\n";
 }
 
 static bool ParseArgs(int argc, char **argv, Config &config, std::string &error)
@@ -147,6 +230,16 @@ static bool ParseArgs(int argc, char **argv, Config &config, std::string &error)
             std::exit(0);
         }
 
+        if (arg == "--list-allocators")
+        {
+            std::vector<std::string> names = bench::AvailableAllocators();
+            for (size_t j = 0; j < names.size(); ++j)
+            {
+                std::cout << names[j] << '\n';
+            }
+            std::exit(0);
+        }
+
         if (arg.rfind("--", 0) != 0)
         {
             error = "Invalid argument: " + arg;
@@ -167,7 +260,7 @@ static bool ParseArgs(int argc, char **argv, Config &config, std::string &error)
         uint64_t n = 0;
         if (key == "allocator")
         {
-            config.allocator = ToLower(value);
+            config.allocator = value.rfind("dlopen:", 0) == 0 ? value : ToLower(value);
         }
         else if (key == "threads")
         {
@@ -231,6 +324,23 @@ static bool ParseArgs(int argc, char **argv, Config &config, std::string &error)
             }
             config.sample_rate = static_cast<size_t>(n);
         }
+        else if (key == "free-order")
+        {
+            config.free_order = ToLower(value);
+        }
+        else if (key == "touch")
+        {
+            config.touch = ToLower(value);
+        }
+        else if (key == "rss-interval-ms")
+        {
+            if (!ParseUInt64(value, n) || n == 0)
+            {
+                error = "Invalid --rss-interval-ms value: " + value;
+                return false;
+            }
+            config.rss_interval_ms = static_cast<size_t>(n);
+        }
         else if (key == "csv")
         {
             config.csv_path = value;
@@ -246,13 +356,12 @@ static bool ParseArgs(int argc, char **argv, Config &config, std::string &error)
         }
     }
 
-    if (config.allocator != "pool" && config.allocator != "malloc")
+    if (!bench::ResolveAllocator(config.allocator, config.plugin, error))
     {
-        error = "Unsupported allocator: " + config.allocator;
         return false;
     }
 
-    if (config.mode != "immediate" && config.mode != "window")
+    if (config.mode != "immediate" && config.mode != "window" && config.mode != "pipeline")
     {
         error = "Unsupported mode: " + config.mode;
         return false;
@@ -264,9 +373,21 @@ static bool ParseArgs(int argc, char **argv, Config &config, std::string &error)
         return false;
     }
 
-    if (config.allocator == "pool" && config.size_dist == "fixed" && config.size > MAX_BYTES)
+    if (config.free_order != "fifo" && config.free_order != "random")
+    {
+        error = "Unsupported free order: " + config.free_order;
+        return false;
+    }
+
+    if (config.touch != "first" && config.touch != "all")
+    {
+        error = "Unsupported touch mode: " + config.touch;
+        return false;
+    }
+
+    if (config.plugin.max_size != 0 && config.size_dist == "fixed" && config.size > config.plugin.max_size)
     {
-        error = "pool allocator only supports size <= MAX_BYTES (256KB).";
+        error = config.allocator + " allocator only supports size <= MAX_BYTES (256KB).";
         return false;
     }
 
@@ -292,25 +413,126 @@ static size_t PickSize(const Config &config, uint64_t &rng_state)
     return sizes[idx];
 }
 
-static void *PoolAlloc(size_t size)
+// 分配器为一次申请实际占用的字节数 (含对齐取整)
+static size_t HeldBytes(const Config &config, void *ptr, size_t size)
 {
-    return ConcurrentAlloc(size);
+    if (config.plugin.usable_size != nullptr)
+    {
+        return config.plugin.usable_size(ptr, size);
+    }
+    return size;
 }
 
-static void PoolFree(void *ptr, size_t size)
+static uint64_t ReadRssBytes()
 {
-    ConcurrentFree(ptr, size);
+#if defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    uint64_t total_pages = 0;
+    uint64_t resident_pages = 0;
+    if (statm >> total_pages >> resident_pages)
+    {
+        return resident_pages * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    }
+#endif
+    return 0;
 }
 
-static void *MallocAlloc(size_t size)
+class MemorySampler
 {
-    return std::malloc(size);
-}
+public:
+    MemorySampler(const std::vector<LiveBytes> &live)
+        : _live(live)
+    {
+        _summary.baseline_rss_bytes = ReadRssBytes();
+        _summary.peak_rss_bytes = _summary.baseline_rss_bytes;
+    }
 
-static void MallocFree(void *ptr, size_t)
-{
-    std::free(ptr);
-}
+    // 采样一次; measuring 为 true 时计入稳态均值
+    void Sample(bool measuring)
+    {
+        uint64_t rss = ReadRssBytes();
+        _summary.peak_rss_bytes = std::max(_summary.peak_rss_bytes, rss);
+        if (!measuring)
+        {
+            return;
+        }
+
+        int64_t requested = 0;
+        int64_t held = 0;
+        for (size_t i = 0; i < _live.size(); ++i)
+        {
+            requested += _live[i].requested.load(std::memory_order_relaxed);
+            held += _live[i].held.load(std::memory_order_relaxed);
+        }
+
+        _rssSum += rss;
+        _requestedSum += static_cast<uint64_t>(std::max<int64_t>(requested, 0));
+        _heldSum += static_cast<uint64_t>(std::max<int64_t>(held, 0));
+        _summary.samples++;
+    }
+
+    // 在 deadline 之前按固定周期采样
+    void SampleUntil(SteadyClock::time_point deadline, size_t interval_ms, bool measuring)
+    {
+        for (;;)
+        {
+            Sample(measuring);
+            SteadyClock::time_point now = SteadyClock::now();
+            if (now >= deadline)
+            {
+                return;
+            }
+            SteadyClock::duration step = std::chrono::milliseconds(interval_ms);
+            std::this_thread::sleep_for(std::min(step, deadline - now));
+        }
+    }
+
+    MemorySummary Finish(const Config &config)
+    {
+        MemorySummary summary = _summary;
+        if (summary.samples > 0)
+        {
+            summary.steady_rss_bytes = _rssSum / summary.samples;
+            summary.live_requested_bytes = _requestedSum / summary.samples;
+            summary.live_held_bytes = _heldSum / summary.samples;
+        }
+
+        uint64_t rss_growth = summary.steady_rss_bytes > summary.baseline_rss_bytes
+                                  ? summary.steady_rss_bytes - summary.baseline_rss_bytes
+                                  : 0;
+        if (config.plugin.is_pool)
+        {
+            summary.mapped_bytes = SystemAllocBytes().load(std::memory_order_relaxed);
+        }
+
+        if (summary.live_held_bytes > 0)
+        {
+            summary.internal_frag = 1.0 - static_cast<double>(summary.live_requested_bytes) /
+                                              static_cast<double>(summary.live_held_bytes);
+        }
+
+        // 统一以 RSS 增量作为占用, 不同分配器之间可比; 未触碰的页不计入 (见 --touch)
+        if (rss_growth > summary.live_held_bytes)
+        {
+            summary.external_frag = 1.0 - static_cast<double>(summary.live_held_bytes) /
+                                              static_cast<double>(rss_growth);
+        }
+
+        if (summary.live_requested_bytes > 0)
+        {
+            summary.overhead_per_live_byte = static_cast<double>(rss_growth) /
+                                             static_cast<double>(summary.live_requested_bytes);
+        }
+        return summary;
+    }
+
+private:
+    const std::vector<LiveBytes> &_live;
+    MemorySummary _summary;
+    uint64_t _rssSum = 0;
+    uint64_t _requestedSum = 0;
+    uint64_t _heldSum = 0;
+};
 
 static uint64_t PercentileNs(std::vector<uint32_t> &samples, double ratio)
 {
@@ -349,6 +571,8 @@ static void WorkerMain(size_t worker_id,
                        std::atomic<size_t> &ready_count,
                        std::atomic<bool> &start_flag,
                        std::atomic<int> &phase, // 0:warmup, 1:measure, 2:stop
+                       LiveBytes &live,
+                       std::vector<Handoff> &handoffs,
                        WorkerStats &out_stats)
 {
     WorkerStats stats;
@@ -365,6 +589,12 @@ static void WorkerMain(size_t worker_id,
     }
 
     uint64_t rng_state = 1469598103934665603ULL ^ (worker_id + 1) * 1099511628211ULL;
+    int64_t live_requested = 0;
+    int64_t live_held = 0;
+    const bool touch_all = config.touch == "all";
+    const bool random_free = config.free_order == "random";
+    Handoff &outbox = handoffs[(worker_id + 1) % handoffs.size()];
+    Handoff &inbox = handoffs[worker_id];
 
     ready_count.fetch_add(1, std::memory_order_release);
     while (!start_flag.load(std::memory_order_acquire))
@@ -383,22 +613,58 @@ static void WorkerMain(size_t worker_id,
 
         if (ptr != nullptr)
         {
+            if (touch_all)
+            {
+                // 写满整个对象, 使 RSS 反映真实的存活字节
+                std::memset(ptr, static_cast<int>(worker_id), size);
+            }
             *reinterpret_cast<volatile char *>(ptr) = static_cast<char>(worker_id);
         }
 
+        size_t held = HeldBytes(config, ptr, size);
+        live_requested += static_cast<int64_t>(size);
+        live_held += static_cast<int64_t>(held);
+
         bool did_free = false;
         uint64_t free_ns = 0;
         if (config.mode == "immediate")
         {
+            live_requested -= static_cast<int64_t>(size);
+            live_held -= static_cast<int64_t>(held);
             auto free_begin = SteadyClock::now();
             free_fn(ptr, size);
             auto free_end = SteadyClock::now();
             free_ns = ToNs(free_end - free_begin);
             did_free = true;
         }
+        else if (config.mode == "pipeline")
+        {
+            void *old_ptr = ptr;
+            size_t old_size = size;
+            // 队列满时退化为本线程释放, 否则释放一个上游 worker 交过来的对象
+            if (outbox.TryPush(ptr, size))
+            {
+                did_free = inbox.TryPop(old_ptr, old_size);
+            }
+            else
+            {
+                did_free = true;
+            }
+
+            if (did_free)
+            {
+                live_requested -= static_cast<int64_t>(old_size);
+                live_held -= static_cast<int64_t>(HeldBytes(config, old_ptr, old_size));
+                auto free_begin = SteadyClock::now();
+                free_fn(old_ptr, old_size);
+                auto free_end = SteadyClock::now();
+                free_ns = ToNs(free_end - free_begin);
+            }
+        }
         else
         {
-            size_t slot = ring_index % config.window;
+            size_t slot = random_free ? static_cast<size_t>(XorShift64(rng_state) % config.window)
+                                      : ring_index % config.window;
             void *old_ptr = ring_ptrs[slot];
             size_t old_size = ring_sizes[slot];
             ring_ptrs[slot] = ptr;
@@ -407,6 +673,8 @@ static void WorkerMain(size_t worker_id,
 
             if (old_ptr != nullptr)
             {
+                live_requested -= static_cast<int64_t>(old_size);
+                live_held -= static_cast<int64_t>(HeldBytes(config, old_ptr, old_size));
                 auto free_begin = SteadyClock::now();
                 free_fn(old_ptr, old_size);
                 auto free_end = SteadyClock::now();
@@ -415,6 +683,9 @@ static void WorkerMain(size_t worker_id,
             }
         }
 
+        live.requested.store(live_requested, std::memory_order_relaxed);
+        live.held.store(live_held, std::memory_order_relaxed);
+
         if (current_phase == 1)
         {
             uint64_t alloc_ns = ToNs(alloc_end - alloc_begin);
@@ -483,7 +754,8 @@ static bool AppendCsv(const BenchmarkResult &result, std::string &error)
 
     if (write_header)
     {
-        out << "timestamp,label,allocator,mode,size_dist,size,threads,warmup_s,measure_s,window,sample_rate,alloc_ops,free_ops,total_ops,ops_per_sec,alloc_avg_ns,alloc_p50_ns,alloc_p95_ns,alloc_p99_ns,alloc_samples,free_avg_ns,free_p50_ns,free_p95_ns,free_p99_ns,free_samples\n";
+        out << "timestamp,label,allocator,mode,size_dist,size,threads,warmup_s,measure_s,window,sample_rate,alloc_ops,free_ops,total_ops,ops_per_sec,alloc_avg_ns,alloc_p50_ns,alloc_p95_ns,alloc_p99_ns,alloc_samples,free_avg_ns,free_p50_ns,free_p95_ns,free_p99_ns,free_samples,"
+               "baseline_rss_bytes,peak_rss_bytes,steady_rss_bytes,live_requested_bytes,live_held_bytes,mapped_bytes,internal_frag,external_frag,overhead_per_live_byte\n";
     }
 
     out << result.timestamp_unix << ','
@@ -510,20 +782,37 @@ static bool AppendCsv(const BenchmarkResult &result, std::string &error)
         << result.free_latency.p50_ns << ','
         << result.free_latency.p95_ns << ','
         << result.free_latency.p99_ns << ','
-        << result.free_latency.samples << '\n';
+        << result.free_latency.samples << ','
+        << result.memory.baseline_rss_bytes << ','
+        << result.memory.peak_rss_bytes << ','
+        << result.memory.steady_rss_bytes << ','
+        << result.memory.live_requested_bytes << ','
+        << result.memory.live_held_bytes << ','
+        << result.memory.mapped_bytes << ','
+        << result.memory.internal_frag << ','
+        << result.memory.external_frag << ','
+        << result.memory.overhead_per_live_byte << '\n';
 
     return true;
 }
 
 static BenchmarkResult RunBenchmark(const Config &config)
 {
-    AllocFn alloc_fn = config.allocator == "pool" ? PoolAlloc : MallocAlloc;
-    FreeFn free_fn = config.allocator == "pool" ? PoolFree : MallocFree;
+    AllocFn alloc_fn = config.plugin.alloc;
+    FreeFn free_fn = config.plugin.free;
 
     std::vector<std::thread> workers;
     workers.reserve(config.threads);
 
     std::vector<WorkerStats> worker_stats(config.threads);
+    std::vector<LiveBytes> live_bytes(config.threads);
+    MemorySampler sampler(live_bytes);
+
+    std::vector<Handoff> handoffs(config.threads);
+    for (size_t i = 0; i < handoffs.size(); ++i)
+    {
+        handoffs[i].Init(config.window);
+    }
 
     std::atomic<size_t> ready_count(0);
     std::atomic<bool> start_flag(false);
@@ -540,6 +829,8 @@ static BenchmarkResult RunBenchmark(const Config &config)
             std::ref(ready_count),
             std::ref(start_flag),
             std::ref(phase),
+            std::ref(live_bytes[i]),
+            std::ref(handoffs),
             std::ref(worker_stats[i])));
     }
 
@@ -552,12 +843,14 @@ static BenchmarkResult RunBenchmark(const Config &config)
 
     if (config.warmup_seconds > 0)
     {
-        std::this_thread::sleep_for(std::chrono::seconds(config.warmup_seconds));
+        sampler.SampleUntil(SteadyClock::now() + std::chrono::seconds(config.warmup_seconds),
+                            config.rss_interval_ms, false);
     }
 
     phase.store(1, std::memory_order_release);
     SteadyClock::time_point measured_start = SteadyClock::now();
-    std::this_thread::sleep_for(std::chrono::seconds(config.measure_seconds));
+    sampler.SampleUntil(measured_start + std::chrono::seconds(config.measure_seconds),
+                        config.rss_interval_ms, true);
     SteadyClock::time_point measured_end = SteadyClock::now();
     phase.store(2, std::memory_order_release);
 
@@ -566,6 +859,17 @@ static BenchmarkResult RunBenchmark(const Config &config)
         workers[i].join();
     }
 
+    // pipeline 模式下队列里剩余的对象
+    for (size_t i = 0; i < handoffs.size(); ++i)
+    {
+        void *ptr = nullptr;
+        size_t size = 0;
+        while (handoffs[i].TryPop(ptr, size))
+        {
+            free_fn(ptr, size);
+        }
+    }
+
     BenchmarkResult result;
     result.config = config;
     result.timestamp_unix = static_cast<int64_t>(
@@ -604,6 +908,12 @@ static BenchmarkResult RunBenchmark(const Config &config)
     }
     result.alloc_latency = BuildLatencySummary(alloc_samples, alloc_ns_total, result.alloc_ops);
     result.free_latency = BuildLatencySummary(free_samples, free_ns_total, result.free_ops);
+    result.memory = sampler.Finish(config);
+    if (config.plugin.is_pool)
+    {
+        result.page_lock = PageCache::GetInstance()->_pageMtx.Stats();
+        CentralCache::GetInstance()->GetLockStats(result.span_locks, result.transfer_locks);
+    }
 
     return result;
 }
@@ -614,6 +924,7 @@ static void PrintResult(const BenchmarkResult &result)
     std::cout << "label: " << result.config.label << '\n';
     std::cout << "allocator: " << result.config.allocator
               << ", mode: " << result.config.mode
+              << ", free_order: " << result.config.free_order
               << ", size_dist: " << result.config.size_dist
               << ", size: " << result.config.size
               << ", threads: " << result.config.threads << '\n';
@@ -638,6 +949,27 @@ static void PrintResult(const BenchmarkResult &result)
               << result.free_latency.p95_ns << " / "
               << result.free_latency.p99_ns
               << " (samples=" << result.free_latency.samples << ")\n";
+
+    std::cout << "rss_bytes(baseline/peak/steady): "
+              << result.memory.baseline_rss_bytes << " / "
+              << result.memory.peak_rss_bytes << " / "
+              << result.memory.steady_rss_bytes
+              << " (samples=" << result.memory.samples << ")\n";
+    std::cout << "live_bytes(requested/held): "
+              << result.memory.live_requested_bytes << " / "
+              << result.memory.live_held_bytes
+              << ", mapped_bytes: " << result.memory.mapped_bytes << '\n';
+    std::cout << "fragmentation(internal/external): "
+              << result.memory.internal_frag << " / "
+              << result.memory.external_frag
+              << ", overhead_per_live_byte: " << result.memory.overhead_per_live_byte << '\n';
+    if (result.config.plugin.is_pool)
+    {
+        std::cout << "lock_acquired/contended(page/central/transfer): "
+                  << result.page_lock._acquisitions << '/' << result.page_lock._contended << " / "
+                  << result.span_locks._acquisitions << '/' << result.span_locks._contended << " / "
+                  << result.transfer_locks._acquisitions << '/' << result.transfer_locks._contended << '\n';
+    }
 }
 } // namespace
 
@@ -0,0 +1,333 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "ConcurrentAlloc.hpp"
+
+// 快路径指令数微基准: 单线程对同一尺寸反复 ConcurrentAlloc + ConcurrentFree,
+// 线程缓存的自由链表长度不变, 每一对操作都只走快路径.
+// 用 perf_event_open 统计用户态退休指令数, 减去只有循环本身的空跑, 得到每对操作的指令数;
+// 机器或容器不允许读性能计数器时只输出耗时.
+// --cold-work=N: 冷自由链表模式. 每轮随机释放一批存活对象, 扫一遍大缓冲区把它们挤出 L1/L2,
+// 再逐个分配回来, 每次分配之后做 N 步计算模拟应用自身的工作. 自由链表里的对象按随机地址排列且不在缓存中,
+// 用于对比 FreeList::Pop 预取下一个对象的效果 (以 -DCMP_NO_PREFETCH=1 编译得到不预取的版本).
+namespace
+{
+using SteadyClock = std::chrono::steady_clock;
+
+struct Config
+{
+    std::vector<size_t> sizes = {8, 64, 256, 1024, 4096, 32768};
+    size_t ops = 10000000;
+    size_t coldWork = 0;
+};
+
+// 冷自由链表模式的参数: 存活对象数, 每轮释放再分配的对象数 (不超过线程缓存的链表上限),
+// 每轮扫过的缓冲区大小 (大于常见的 L2)
+static const size_t COLD_LIVE_OBJECTS = 1 << 16;
+static const size_t COLD_BURST = 128;
+static const size_t COLD_EVICT_BYTES = 8 << 20;
+
+// 用户态指令计数器, 打开失败时 Valid() 为 false
+class InstructionCounter
+{
+public:
+    InstructionCounter()
+    {
+#ifdef __linux__
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        _fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        if (_fd < 0)
+        {
+            _error = strerror(errno);
+        }
+#else
+        _error = "perf_event_open is Linux only";
+#endif
+    }
+
+    ~InstructionCounter()
+    {
+#ifdef __linux__
+        if (_fd >= 0)
+        {
+            close(_fd);
+        }
+#endif
+    }
+
+    bool Valid() const
+    {
+        return _fd >= 0;
+    }
+
+    const std::string &Error() const
+    {
+        return _error;
+    }
+
+    void Start()
+    {
+#ifdef __linux__
+        if (_fd >= 0)
+        {
+            ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    uint64_t Stop()
+    {
+        uint64_t count = 0;
+#ifdef __linux__
+        if (_fd >= 0)
+        {
+            ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(_fd, &count, sizeof(count)) != static_cast<ssize_t>(sizeof(count)))
+            {
+                count = 0;
+            }
+        }
+#endif
+        return count;
+    }
+
+private:
+    int _fd = -1;
+    std::string _error;
+};
+
+// 阻止编译器把分配/释放对消掉或把循环合并
+inline void Escape(void *p)
+{
+    asm volatile("" : : "g"(p) : "memory");
+}
+
+struct Measure
+{
+    uint64_t instructions = 0;
+    double ns = 0.0;
+};
+
+template <class Body>
+Measure RunLoop(InstructionCounter &counter, size_t ops, Body body)
+{
+    Measure m;
+    SteadyClock::time_point begin = SteadyClock::now();
+    counter.Start();
+    for (size_t i = 0; i < ops; ++i)
+    {
+        body();
+    }
+    m.instructions = counter.Stop();
+    SteadyClock::time_point end = SteadyClock::now();
+    m.ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+    return m;
+}
+
+static bool ParseArgs(int argc, char **argv, Config &config, std::string &error)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 7, "--size=") == 0)
+        {
+            config.sizes.clear();
+            std::string list = arg.substr(7);
+            size_t begin = 0;
+            while (begin < list.size())
+            {
+                size_t comma = list.find(',', begin);
+                if (comma == std::string::npos)
+                {
+                    comma = list.size();
+                }
+                size_t size = std::strtoull(list.substr(begin, comma - begin).c_str(), nullptr, 10);
+                if (size == 0 || size > THREAD_CACHE_MAX_BYTES)
+                {
+                    error = "--size must be in [1, " + std::to_string(THREAD_CACHE_MAX_BYTES) + "]";
+                    return false;
+                }
+                config.sizes.push_back(size);
+                begin = comma + 1;
+            }
+        }
+        else if (arg.compare(0, 6, "--ops=") == 0)
+        {
+            config.ops = std::strtoull(arg.c_str() + 6, nullptr, 10);
+            if (config.ops == 0)
+            {
+                error = "--ops must be > 0";
+                return false;
+            }
+        }
+        else if (arg.compare(0, 12, "--cold-work=") == 0)
+        {
+            config.coldWork = std::strtoull(arg.c_str() + 12, nullptr, 10);
+        }
+        else
+        {
+            error = "unknown argument: " + arg;
+            return false;
+        }
+    }
+    return !config.sizes.empty();
+}
+
+inline uint64_t XorShift64(uint64_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+// 不访问内存的串行计算, 模拟两次分配之间应用自己的工作
+inline uint64_t Work(size_t steps, uint64_t &rng)
+{
+    for (size_t i = 0; i < steps; ++i)
+    {
+        XorShift64(rng);
+    }
+    return rng;
+}
+
+// 每条缓存行写一次, 把之前访问过的对象挤出 L1/L2
+inline void Evict(std::vector<unsigned char> &buffer)
+{
+    for (size_t i = 0; i < buffer.size(); i += 64)
+    {
+        buffer[i]++;
+    }
+    Escape(buffer.data());
+}
+
+// 返回每次分配 (含之后的工作) 的平均耗时
+double RunCold(const Config &config, size_t size)
+{
+    std::vector<void *> live(COLD_LIVE_OBJECTS);
+    for (size_t i = 0; i < live.size(); ++i)
+    {
+        live[i] = ConcurrentAlloc(size);
+    }
+    std::vector<unsigned char> buffer(COLD_EVICT_BYTES);
+    std::vector<size_t> slots(COLD_BURST);
+    uint64_t rng = 0x9e3779b97f4a7c15ull;
+    uint64_t sink = 0;
+
+    size_t rounds = std::max<size_t>(1, config.ops / COLD_BURST / 100);
+    double ns = 0.0;
+    for (size_t r = 0; r < rounds; ++r)
+    {
+        for (size_t i = 0; i < COLD_BURST; ++i)
+        {
+            slots[i] = XorShift64(rng) % live.size();
+            if (live[slots[i]] != nullptr)
+            {
+                ConcurrentFree(live[slots[i]], size);
+                live[slots[i]] = nullptr;
+            }
+        }
+        Evict(buffer);
+
+        SteadyClock::time_point begin = SteadyClock::now();
+        for (size_t i = 0; i < COLD_BURST; ++i)
+        {
+            void *p = ConcurrentAlloc(size);
+            *static_cast<volatile char *>(p) = 0;
+            if (live[slots[i]] != nullptr)
+            {
+                ConcurrentFree(live[slots[i]], size);
+            }
+            live[slots[i]] = p;
+            sink += Work(config.coldWork, rng);
+        }
+        SteadyClock::time_point end = SteadyClock::now();
+        ns += static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+    }
+
+    for (size_t i = 0; i < live.size(); ++i)
+    {
+        if (live[i] != nullptr)
+        {
+            ConcurrentFree(live[i], size);
+        }
+    }
+    Escape(&sink);
+    return ns / static_cast<double>(rounds * COLD_BURST);
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Config config;
+    std::string error;
+    if (!ParseArgs(argc, argv, config, error))
+    {
+        std::cerr << "Argument error: " << error << '\n'
+                  << "Usage: " << argv[0] << " [--size=8,64,...] [--ops=N] [--cold-work=N]\n";
+        return 1;
+    }
+
+    if (config.coldWork != 0)
+    {
+        std::cout << "=== fastpath_bench (cold free lists, " << config.coldWork << " steps of work per allocation) ===\n";
+        for (size_t s = 0; s < config.sizes.size(); ++s)
+        {
+            std::cout << "size " << config.sizes[s] << ": " << RunCold(config, config.sizes[s]) << " ns/alloc\n";
+        }
+        return 0;
+    }
+
+    InstructionCounter counter;
+    std::cout << "=== fastpath_bench ===\n";
+    if (!counter.Valid())
+    {
+        std::cout << "instruction counter unavailable (" << counter.Error() << "), reporting time only\n";
+    }
+
+    int dummy = 0;
+    Measure loop = RunLoop(counter, config.ops, [&]() { Escape(&dummy); });
+
+    for (size_t s = 0; s < config.sizes.size(); ++s)
+    {
+        size_t size = config.sizes[s];
+        // 预热: 创建线程缓存并让该尺寸类的自由链表里有对象
+        ConcurrentFree(ConcurrentAlloc(size), size);
+
+        Measure pair = RunLoop(counter, config.ops, [&]() {
+            void *p = ConcurrentAlloc(size);
+            Escape(p);
+            ConcurrentFree(p, size);
+        });
+
+        std::cout << "size " << size << ": " << pair.ns / config.ops << " ns/pair";
+        if (counter.Valid())
+        {
+            double insns = static_cast<double>(pair.instructions - loop.instructions) / config.ops;
+            std::cout << ", " << insns << " instructions/pair (alloc + free, loop overhead removed)";
+        }
+        std::cout << '\n';
+    }
+    return 0;
+}
@@ -0,0 +1,574 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "CentralCache.hpp"
+#include "ConcurrentAlloc.hpp"
+
+// 逐层微基准: 绕过上层缓存直接驱动某一层, 用来定位是哪一层退化.
+//   size-class   : SizeClass::RoundUp + SizeClass::Index
+//   map-object   : PageCache::MapObjectToSpan
+//   thread-cache : 线程私有 ThreadCache 的 Allocate + Deallocate
+//   central-cache: CentralCache::FetchRangeObj + ReleaseListToSpans (一批)
+//   page-cache   : PageCache::NewSpan + ReleaseSpanToPageCache (持 _pageMtx)
+namespace
+{
+using SteadyClock = std::chrono::steady_clock;
+
+struct Config
+{
+    std::vector<std::string> layers;
+    std::vector<size_t> threads;
+    std::string contention = "shared"; // shared: 所有线程同一 size class; private: 每线程不同 size class
+    std::string csv_path;              // optional
+    std::string label = "default";     // optional scenario label
+    size_t size = 64;
+    size_t batch = 32;                 // thread-cache 每轮持有对象数 / central-cache 每批对象数
+    size_t pages = 1;                  // page-cache 每次申请的页数
+    size_t work = 0;                   // 两次操作之间的空转次数, 用来调节竞争强度
+    size_t ops = 1000000;              // 每线程操作次数
+};
+
+struct LayerResult
+{
+    std::string layer;
+    size_t threads = 0;
+    uint64_t ops = 0;
+    double seconds = 0.0;
+    double ns_per_op = 0.0;   // 每线程视角的平均耗时
+    double ops_per_sec = 0.0; // 所有线程合计吞吐
+};
+
+static std::string ToLower(std::string s)
+{
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        if (s[i] >= 'A' && s[i] <= 'Z')
+        {
+            s[i] = static_cast<char>(s[i] - 'A' + 'a');
+        }
+    }
+    return s;
+}
+
+static bool ParseUInt64(const std::string &s, uint64_t &value)
+{
+    if (s.empty())
+    {
+        return false;
+    }
+
+    char *end = nullptr;
+    unsigned long long parsed = std::strtoull(s.c_str(), &end, 10);
+    if (end == s.c_str() || *end != '\0')
+    {
+        return false;
+    }
+
+    value = static_cast<uint64_t>(parsed);
+    return true;
+}
+
+static std::vector<std::string> SplitList(const std::string &s)
+{
+    std::vector<std::string> items;
+    size_t begin = 0;
+    while (begin <= s.size())
+    {
+        size_t comma = s.find(',', begin);
+        if (comma == std::string::npos)
+        {
+            comma = s.size();
+        }
+        if (comma > begin)
+        {
+            items.push_back(s.substr(begin, comma - begin));
+        }
+        begin = comma + 1;
+    }
+    return items;
+}
+
+static const std::vector<std::string> &AllLayers()
+{
+    static const std::vector<std::string> kLayers = {
+        "size-class", "map-object", "thread-cache", "central-cache", "page-cache"};
+    return kLayers;
+}
+
+static void PrintUsage(const char *prog)
+{
+    std::cout
+        << "Usage:\n"
+        << "  " << prog
+        << " [--layers=size-class,map-object,thread-cache,central-cache,page-cache]"
+        << " [--threads=1,2,4,8]"
+        << " [--contention=shared|private]"
+        << " [--size=BYTES]"
+        << " [--batch=N]"
+        << " [--pages=N]"
+        << " [--work=N]"
+        << " [--ops=N]"
+        << " [--label=NAME]"
+        << " [--csv=/path/file.csv]\n"
+        << "  " << prog << " --size-classes\n\n"
+        << "One op is: one RoundUp+Index (size-class), one lookup (map-object),\n"
+        << "one Allocate+Deallocate (thread-cache), one FetchRangeObj+ReleaseListToSpans\n"
+        << "of --batch objects (central-cache), one NewSpan+ReleaseSpanToPageCache (page-cache).\n"
+        << "--size-classes prints the per-class table (batch, span pages, tail waste, transfer slots) and exits.\n";
+}
+
+// 打印每个尺寸类的参数表, 核对 span 是否放得下一批、尾部浪费是否可接受
+static void PrintSizeClasses()
+{
+    std::cout << "class,size,batch,pages,objs_per_span,tail_waste_pct,transfer_slots\n";
+    for (size_t i = 0; i < NFREELIST; ++i)
+    {
+        const SizeClassInfo &info = SizeClass::Info(i);
+        size_t bytes = info._pages << PAGE_SHIFT;
+        std::cout << i << ','
+                  << info._size << ','
+                  << info._batch << ','
+                  << info._pages << ','
+                  << bytes / info._size << ','
+                  << 100.0 * static_cast<double>(bytes % info._size) / static_cast<double>(bytes) << ','
+                  << info._transferSlots << '\n';
+    }
+}
+
+static bool ParseArgs(int argc, char **argv, Config &config, std::string &error)
+{
+    config.layers = AllLayers();
+    unsigned int hw = std::thread::hardware_concurrency();
+    for (size_t t = 1; t <= (hw == 0 ? 1 : hw); t *= 2)
+    {
+        config.threads.push_back(t);
+    }
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            PrintUsage(argv[0]);
+            std::exit(0);
+        }
+        if (arg == "--size-classes")
+        {
+            PrintSizeClasses();
+            std::exit(0);
+        }
+
+        size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos || eq <= 2 || eq + 1 >= arg.size())
+        {
+            error = "Expected --key=value format: " + arg;
+            return false;
+        }
+
+        std::string key = ToLower(arg.substr(2, eq - 2));
+        std::string value = arg.substr(eq + 1);
+        uint64_t n = 0;
+        if (key == "layers")
+        {
+            config.layers = SplitList(ToLower(value));
+        }
+        else if (key == "threads")
+        {
+            config.threads.clear();
+            std::vector<std::string> items = SplitList(value);
+            for (size_t j = 0; j < items.size(); ++j)
+            {
+                if (!ParseUInt64(items[j], n) || n == 0)
+                {
+                    error = "Invalid --threads value: " + value;
+                    return false;
+                }
+                config.threads.push_back(static_cast<size_t>(n));
+            }
+        }
+        else if (key == "contention")
+        {
+            config.contention = ToLower(value);
+        }
+        else if (key == "size" || key == "batch" || key == "pages" || key == "work" || key == "ops")
+        {
+            if (!ParseUInt64(value, n) || (n == 0 && key != "work"))
+            {
+                error = "Invalid --" + key + " value: " + value;
+                return false;
+            }
+            if (key == "size")
+            {
+                config.size = static_cast<size_t>(n);
+            }
+            else if (key == "batch")
+            {
+                config.batch = static_cast<size_t>(n);
+            }
+            else if (key == "pages")
+            {
+                config.pages = static_cast<size_t>(n);
+            }
+            else if (key == "work")
+            {
+                config.work = static_cast<size_t>(n);
+            }
+            else
+            {
+                config.ops = static_cast<size_t>(n);
+            }
+        }
+        else if (key == "csv")
+        {
+            config.csv_path = value;
+        }
+        else if (key == "label")
+        {
+            config.label = value;
+        }
+        else
+        {
+            error = "Unknown argument: --" + key;
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < config.layers.size(); ++i)
+    {
+        const std::vector<std::string> &all = AllLayers();
+        if (std::find(all.begin(), all.end(), config.layers[i]) == all.end())
+        {
+            error = "Unsupported layer: " + config.layers[i];
+            return false;
+        }
+    }
+
+    if (config.threads.empty())
+    {
+        error = "--threads must not be empty";
+        return false;
+    }
+
+    if (config.contention != "shared" && config.contention != "private")
+    {
+        error = "Unsupported contention: " + config.contention;
+        return false;
+    }
+
+    if (config.size > THREAD_CACHE_MAX_BYTES)
+    {
+        error = "--size must be <= THREAD_CACHE_MAX_BYTES (64KB)";
+        return false;
+    }
+
+    if (config.pages >= NPAGES)
+    {
+        error = "--pages must be < NPAGES";
+        return false;
+    }
+
+    return true;
+}
+
+static void Spin(size_t work)
+{
+    for (size_t i = 0; i < work; ++i)
+    {
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+}
+
+// private 竞争模式下每个线程使用不同的 size class, 消除同一把桶锁上的竞争
+static size_t SizeFor(const Config &config, size_t worker_id)
+{
+    if (config.contention == "shared")
+    {
+        return config.size;
+    }
+    size_t size = config.size + worker_id * 128;
+    return std::min(size, THREAD_CACHE_MAX_BYTES);
+}
+
+static void RunSizeClass(const Config &config, size_t)
+{
+    static const size_t kSizes[] = {8, 24, 100, 129, 1000, 1025, 5000, 8193, 30000, 65536};
+    volatile size_t sink = 0;
+    for (size_t i = 0; i < config.ops; ++i)
+    {
+        size_t bytes = kSizes[i % (sizeof(kSizes) / sizeof(kSizes[0]))];
+        sink = sink + SizeClass::RoundUp(bytes) + SizeClass::Index(bytes);
+        Spin(config.work);
+    }
+}
+
+static void RunMapObject(const Config &config, size_t worker_id, std::vector<void *> &objs)
+{
+    volatile uintptr_t sink = 0;
+    PageCache *pc = PageCache::GetInstance();
+    for (size_t i = 0; i < config.ops; ++i)
+    {
+        sink = sink + reinterpret_cast<uintptr_t>(pc->MapObjectToSpan(objs[(i + worker_id) % objs.size()]));
+        Spin(config.work);
+    }
+}
+
+static void RunThreadCache(const Config &config, size_t worker_id)
+{
+    // 独立的 ThreadCache 实例, 结束时缓存在其中的少量对象不再归还
+    ThreadCache cache;
+    size_t size = SizeFor(config, worker_id);
+    std::vector<void *> held(config.batch);
+    for (size_t i = 0; i < config.ops; i += config.batch)
+    {
+        size_t n = std::min(config.batch, config.ops - i);
+        for (size_t j = 0; j < n; ++j)
+        {
+            held[j] = cache.Allocate(size);
+        }
+        for (size_t j = 0; j < n; ++j)
+        {
+            cache.Deallocate(held[j], size);
+            Spin(config.work);
+        }
+    }
+}
+
+static void RunCentralCache(const Config &config, size_t worker_id)
+{
+    CentralCache *cc = CentralCache::GetInstance();
+    size_t size = SizeClass::RoundUp(SizeFor(config, worker_id));
+    size_t batch = std::min(config.batch, SizeClass::NumMoveSize(size));
+    for (size_t i = 0; i < config.ops; ++i)
+    {
+        void *start = nullptr;
+        void *end = nullptr;
+        size_t n = cc->FetchRangeObj(start, end, batch, size);
+        cc->ReleaseListToSpans(start, size, n);
+        Spin(config.work);
+    }
+}
+
+static void RunPageCache(const Config &config, size_t)
+{
+    PageCache *pc = PageCache::GetInstance();
+    for (size_t i = 0; i < config.ops; ++i)
+    {
+        pc->_pageMtx.lock();
+        Span *span = pc->NewSpan(config.pages);
+        pc->_pageMtx.unlock();
+
+        pc->_pageMtx.lock();
+        pc->ReleaseSpanToPageCache(span);
+        pc->_pageMtx.unlock();
+        Spin(config.work);
+    }
+}
+
+static LayerResult RunLayer(const Config &config, const std::string &layer, size_t threads)
+{
+    // map-object 需要真实存在的对象, 提前在主线程准备好
+    std::vector<void *> objs;
+    if (layer == "map-object")
+    {
+        for (size_t i = 0; i < 4096; ++i)
+        {
+            objs.push_back(ConcurrentAlloc(config.size));
+        }
+    }
+
+    std::atomic<size_t> ready(0);
+    std::atomic<bool> start_flag(false);
+    std::vector<uint64_t> worker_ns(threads, 0);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t)
+    {
+        workers.push_back(std::thread([&, t]()
+                                      {
+            ready.fetch_add(1, std::memory_order_release);
+            while (!start_flag.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+
+            SteadyClock::time_point begin = SteadyClock::now();
+            if (layer == "size-class")
+            {
+                RunSizeClass(config, t);
+            }
+            else if (layer == "map-object")
+            {
+                RunMapObject(config, t, objs);
+            }
+            else if (layer == "thread-cache")
+            {
+                RunThreadCache(config, t);
+            }
+            else if (layer == "central-cache")
+            {
+                RunCentralCache(config, t);
+            }
+            else
+            {
+                RunPageCache(config, t);
+            }
+            worker_ns[t] = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(SteadyClock::now() - begin).count()); }));
+    }
+
+    while (ready.load(std::memory_order_acquire) != threads)
+    {
+        std::this_thread::yield();
+    }
+
+    SteadyClock::time_point begin = SteadyClock::now();
+    start_flag.store(true, std::memory_order_release);
+    for (size_t t = 0; t < workers.size(); ++t)
+    {
+        workers[t].join();
+    }
+    SteadyClock::time_point end = SteadyClock::now();
+
+    for (size_t i = 0; i < objs.size(); ++i)
+    {
+        ConcurrentFree(objs[i], config.size);
+    }
+
+    LayerResult result;
+    result.layer = layer;
+    result.threads = threads;
+    result.ops = static_cast<uint64_t>(config.ops) * threads;
+    result.seconds = std::chrono::duration_cast<std::chrono::duration<double>>(end - begin).count();
+
+    uint64_t ns_total = 0;
+    for (size_t t = 0; t < threads; ++t)
+    {
+        ns_total += worker_ns[t];
+    }
+    result.ns_per_op = static_cast<double>(ns_total) / static_cast<double>(result.ops);
+    if (result.seconds > 0.0)
+    {
+        result.ops_per_sec = static_cast<double>(result.ops) / result.seconds;
+    }
+    return result;
+}
+
+static bool AppendCsv(const Config &config, const std::vector<LayerResult> &results, std::string &error)
+{
+    if (config.csv_path.empty())
+    {
+        return true;
+    }
+
+    bool write_header = true;
+    {
+        std::ifstream existing(config.csv_path.c_str(), std::ios::in);
+        if (existing.good())
+        {
+            existing.peek();
+            if (!existing.eof())
+            {
+                write_header = false;
+            }
+        }
+    }
+
+    std::ofstream out(config.csv_path.c_str(), std::ios::app);
+    if (!out.is_open())
+    {
+        error = "Failed to open csv file: " + config.csv_path;
+        return false;
+    }
+
+    if (write_header)
+    {
+        out << "label,layer,threads,contention,size,batch,pages,work,ops,seconds,ns_per_op,ops_per_sec,scaling\n";
+    }
+
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const LayerResult &r = results[i];
+        // scaling: 相对本层单线程 (列表中第一个线程数) 吞吐的倍数
+        double base = 0.0;
+        for (size_t j = 0; j < results.size(); ++j)
+        {
+            if (results[j].layer == r.layer)
+            {
+                base = results[j].ops_per_sec;
+                break;
+            }
+        }
+
+        out << config.label << ','
+            << r.layer << ','
+            << r.threads << ','
+            << config.contention << ','
+            << config.size << ','
+            << config.batch << ','
+            << config.pages << ','
+            << config.work << ','
+            << r.ops << ','
+            << r.seconds << ','
+            << r.ns_per_op << ','
+            << r.ops_per_sec << ','
+            << (base > 0.0 ? r.ops_per_sec / base : 0.0) << '\n';
+    }
+    return true;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Config config;
+    std::string error;
+    if (!ParseArgs(argc, argv, config, error))
+    {
+        std::cerr << "Argument error: " << error << '\n';
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    std::cout << "=== layer_bench ===\n";
+    std::cout << "label: " << config.label
+              << ", contention: " << config.contention
+              << ", size: " << config.size
+              << ", batch: " << config.batch
+              << ", pages: " << config.pages
+              << ", work: " << config.work
+              << ", ops/thread: " << config.ops << '\n';
+
+    std::vector<LayerResult> results;
+    for (size_t i = 0; i < config.layers.size(); ++i)
+    {
+        double base = 0.0;
+        for (size_t j = 0; j < config.threads.size(); ++j)
+        {
+            LayerResult r = RunLayer(config, config.layers[i], config.threads[j]);
+            if (j == 0)
+            {
+                base = r.ops_per_sec;
+            }
+            std::cout << r.layer
+                      << " threads=" << r.threads
+                      << " ns/op=" << r.ns_per_op
+                      << " ops/s=" << r.ops_per_sec
+                      << " scaling=" << (base > 0.0 ? r.ops_per_sec / base : 0.0) << '\n';
+            results.push_back(r);
+        }
+    }
+
+    if (!AppendCsv(config, results, error))
+    {
+        std::cerr << error << '\n';
+        return 2;
+    }
+    return 0;
+}
@@ -9,8 +9,8 @@ WARMUP_SECONDS="${WARMUP_SECONDS:-2}"
 MEASURE_SECONDS="${MEASURE_SECONDS:-5}"
 WINDOW_SIZE="${WINDOW_SIZE:-4096}"
 SAMPLE_RATE="${SAMPLE_RATE:-1024}"
+TOUCH="${TOUCH:-first}"
 
-ALLOCATORS=(${ALLOCATORS:-pool malloc})
 THREADS=(${THREADS:-1 2 4 8})
 SIZES=(${SIZES:-8 64 256 1024 4096})
 MODES=(${MODES:-immediate window})
@@ -22,6 +22,9 @@ CSV="${ROOT_DIR}/bench/results/raw/allocator_bench_${TS}.csv"
 cd "${ROOT_DIR}"
 make bench
 
+# 默认比较本机所有可用的分配器 (内置 + 可 dlopen 的 jemalloc/tcmalloc/mimalloc)
+ALLOCATORS=(${ALLOCATORS:-$("${BIN}" --list-allocators)})
+
 echo "Writing benchmark output to: ${CSV}"
 
 for allocator in "${ALLOCATORS[@]}"; do
@@ -39,6 +42,7 @@ for allocator in "${ALLOCATORS[@]}"; do
           --warmup="${WARMUP_SECONDS}" \
           --seconds="${MEASURE_SECONDS}" \
           --sample-rate="${SAMPLE_RATE}" \
+          --touch="${TOUCH}" \
           --label="${label}" \
           --csv="${CSV}"
       done
@@ -59,6 +63,7 @@ for allocator in "${ALLOCATORS[@]}"; do
       --warmup="${WARMUP_SECONDS}" \
       --seconds="${MEASURE_SECONDS}" \
       --sample-rate="${SAMPLE_RATE}" \
+      --touch="${TOUCH}" \
       --label="${label}" \
       --csv="${CSV}"
   done
@@ -66,3 +71,9 @@ done
 
 echo "Done."
 echo "CSV path: ${CSV}"
+
+if command -v python3 >/dev/null 2>&1; then
+  python3 "${SCRIPT_DIR}/summarize.py" "${CSV}" \
+    --markdown="${CSV%.csv}_summary.md" \
+    --plot-dir="${CSV%.csv}_plots"
+fi
@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+"""Summarize allocator_bench CSV output into a head-to-head comparison table.
+
+Usage:
+  bench/summarize.py results.csv [more.csv ...] [--baseline=pool]
+                     [--markdown=summary.md] [--plot-dir=plots/]
+
+Rows are grouped by scenario (mode, size_dist, size, threads); each allocator
+becomes a column with its throughput and the gain of the baseline over it.
+Plots (ops/sec vs. threads, one file per mode/size) need matplotlib and are
+skipped when it is not installed.
+"""
+
+import argparse
+import csv
+import os
+import sys
+from collections import OrderedDict
+
+
+def load_rows(paths):
+    rows = []
+    for path in paths:
+        with open(path, newline="") as f:
+            rows.extend(csv.DictReader(f))
+    return rows
+
+
+def scenario_key(row):
+    return (row["mode"], row["size_dist"], int(row["size"]), int(row["threads"]))
+
+
+def build_table(rows):
+    # 同一场景同一分配器多次运行时取平均
+    table = OrderedDict()
+    allocators = []
+    for row in rows:
+        key = scenario_key(row)
+        name = row["allocator"]
+        if name not in allocators:
+            allocators.append(name)
+        cell = table.setdefault(key, {}).setdefault(name, {"ops": 0.0, "p99": 0.0, "rss": 0.0, "n": 0})
+        cell["ops"] += float(row["ops_per_sec"])
+        cell["p99"] += float(row["alloc_p99_ns"])
+        cell["rss"] += float(row.get("peak_rss_bytes") or 0)
+        cell["n"] += 1
+
+    for cells in table.values():
+        for cell in cells.values():
+            for field in ("ops", "p99", "rss"):
+                cell[field] /= cell["n"]
+    return OrderedDict(sorted(table.items())), allocators
+
+
+def render_markdown(table, allocators, baseline):
+    header = ["mode", "size_dist", "size", "threads"]
+    for name in allocators:
+        header.append("%s ops/s" % name)
+        header.append("%s p99 ns" % name)
+        header.append("%s peak RSS MiB" % name)
+    others = [name for name in allocators if name != baseline]
+    for name in others:
+        header.append("%s vs %s" % (baseline, name))
+
+    lines = ["| " + " | ".join(header) + " |",
+             "| " + " | ".join(["---"] * 4 + ["---:"] * (len(header) - 4)) + " |"]
+    for key, cells in table.items():
+        cols = [key[0], key[1], str(key[2]), str(key[3])]
+        for name in allocators:
+            cell = cells.get(name)
+            if cell is None:
+                cols.extend(["-", "-", "-"])
+            else:
+                cols.append("%.3g" % cell["ops"])
+                cols.append("%.0f" % cell["p99"])
+                cols.append("%.1f" % (cell["rss"] / (1 << 20)))
+        for name in others:
+            base = cells.get(baseline)
+            other = cells.get(name)
+            if base is None or other is None or other["ops"] == 0:
+                cols.append("-")
+            else:
+                cols.append("%+.1f%%" % ((base["ops"] / other["ops"] - 1.0) * 100.0))
+        lines.append("| " + " | ".join(cols) + " |")
+    return "\n".join(lines) + "\n"
+
+
+def render_plots(table, allocators, plot_dir):
+    try:
+        import matplotlib
+        matplotlib.use("Agg")
+        import matplotlib.pyplot as plt
+    except ImportError:
+        print("matplotlib not installed, skipping plots", file=sys.stderr)
+        return
+
+    os.makedirs(plot_dir, exist_ok=True)
+    groups = OrderedDict()
+    for (mode, size_dist, size, threads), cells in table.items():
+        groups.setdefault((mode, size_dist, size), []).append((threads, cells))
+
+    for (mode, size_dist, size), points in groups.items():
+        fig, ax = plt.subplots()
+        for name in allocators:
+            xs = [t for t, cells in points if name in cells]
+            ys = [cells[name]["ops"] for t, cells in points if name in cells]
+            if xs:
+                ax.plot(xs, ys, marker="o", label=name)
+        ax.set_xlabel("threads")
+        ax.set_ylabel("ops/sec")
+        ax.set_title("%s %s size=%d" % (mode, size_dist, size))
+        ax.legend()
+        fig.savefig(os.path.join(plot_dir, "%s_%s_s%d.png" % (mode, size_dist, size)))
+        plt.close(fig)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("csv", nargs="+")
+    parser.add_argument("--baseline", default="pool")
+    parser.add_argument("--markdown")
+    parser.add_argument("--plot-dir")
+    args = parser.parse_args()
+
+    table, allocators = build_table(load_rows(args.csv))
+    markdown = render_markdown(table, allocators, args.baseline)
+    sys.stdout.write(markdown)
+    if args.markdown:
+        with open(args.markdown, "w") as f:
+            f.write(markdown)
+    if args.plot_dir:
+        render_plots(table, allocators, args.plot_dir)
+
+
+if __name__ == "__main__":
+    main()
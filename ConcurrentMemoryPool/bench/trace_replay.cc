@@ -0,0 +1,440 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "AllocTrace.hpp"
+#include "BenchAllocators.hpp"
+
+namespace
+{
+using SteadyClock = std::chrono::steady_clock;
+using cmp::trace::TraceFileHeader;
+using cmp::trace::TraceRecord;
+
+struct Config
+{
+    std::string trace_path;
+    std::string allocator = "pool";  // see allocator_bench --list-allocators
+    std::string order = "strict";    // strict | thread
+    std::string csv_path;            // optional
+    std::string label = "default";   // optional scenario label
+    size_t repeat = 1;
+    bench::AllocatorPlugin plugin;   // resolved from allocator
+};
+
+// 回放用的操作: 指针地址在加载阶段被换算成对象编号, 地址复用不会混淆
+struct ReplayOp
+{
+    uint64_t object;
+    uint32_t size;
+    uint8_t op;
+};
+
+struct Trace
+{
+    std::vector<std::vector<ReplayOp>> threads;
+    std::vector<std::vector<uint64_t>> positions; // 每个操作在全局顺序中的位置 (strict 模式用)
+    size_t objects = 0;
+    size_t total_ops = 0;
+    size_t skipped_frees = 0;
+};
+
+struct ReplayResult
+{
+    double seconds = 0.0;
+    uint64_t ops = 0;
+    double ops_per_sec = 0.0;
+};
+
+using bench::AllocFn;
+using bench::FreeFn;
+
+static std::string ToLower(std::string s)
+{
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        if (s[i] >= 'A' && s[i] <= 'Z')
+        {
+            s[i] = static_cast<char>(s[i] - 'A' + 'a');
+        }
+    }
+    return s;
+}
+
+static void PrintUsage(const char *prog)
+{
+    std::cout
+        << "Usage:\n"
+        << "  " << prog
+        << " --trace=FILE"
+        << " [--allocator=NAME]"
+        << " [--order=strict|thread]"
+        << " [--repeat=N]"
+        << " [--label=NAME]"
+        << " [--csv=/path/file.csv]\n\n"
+        << "  strict: replay with the recorded global interleaving of all threads\n"
+        << "  thread: keep per-thread order, only wait for cross-thread frees\n\n"
+        << "Record a trace by building the application with -DCMP_ALLOC_TRACE=1\n"
+        << "(output path from CMP_TRACE_FILE, default cmp_alloc_trace.bin).\n";
+}
+
+static bool ParseArgs(int argc, char **argv, Config &config, std::string &error)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            PrintUsage(argv[0]);
+            std::exit(0);
+        }
+
+        size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos || eq <= 2 || eq + 1 >= arg.size())
+        {
+            error = "Expected --key=value format: " + arg;
+            return false;
+        }
+
+        std::string key = ToLower(arg.substr(2, eq - 2));
+        std::string value = arg.substr(eq + 1);
+        if (key == "trace")
+        {
+            config.trace_path = value;
+        }
+        else if (key == "allocator")
+        {
+            config.allocator = value.rfind("dlopen:", 0) == 0 ? value : ToLower(value);
+        }
+        else if (key == "order")
+        {
+            config.order = ToLower(value);
+        }
+        else if (key == "repeat")
+        {
+            char *end = nullptr;
+            unsigned long long n = std::strtoull(value.c_str(), &end, 10);
+            if (end == value.c_str() || *end != '\0' || n == 0)
+            {
+                error = "Invalid --repeat value: " + value;
+                return false;
+            }
+            config.repeat = static_cast<size_t>(n);
+        }
+        else if (key == "csv")
+        {
+            config.csv_path = value;
+        }
+        else if (key == "label")
+        {
+            config.label = value;
+        }
+        else
+        {
+            error = "Unknown argument: --" + key;
+            return false;
+        }
+    }
+
+    if (config.trace_path.empty())
+    {
+        error = "--trace is required";
+        return false;
+    }
+
+    if (!bench::ResolveAllocator(config.allocator, config.plugin, error))
+    {
+        return false;
+    }
+
+    if (config.order != "strict" && config.order != "thread")
+    {
+        error = "Unsupported order: " + config.order;
+        return false;
+    }
+
+    return true;
+}
+
+static bool LoadTrace(const std::string &path, Trace &trace, std::string &error)
+{
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+    if (!in.is_open())
+    {
+        error = "Failed to open trace file: " + path;
+        return false;
+    }
+
+    TraceFileHeader header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        header.magic != cmp::trace::kTraceMagic ||
+        header.version != cmp::trace::kTraceVersion ||
+        header.recordSize != sizeof(TraceRecord))
+    {
+        error = "Not a compatible allocation trace: " + path;
+        return false;
+    }
+
+    std::vector<TraceRecord> records;
+    TraceRecord rec;
+    while (in.read(reinterpret_cast<char *>(&rec), sizeof(rec)))
+    {
+        records.push_back(rec);
+    }
+
+    std::sort(records.begin(), records.end(),
+              [](const TraceRecord &a, const TraceRecord &b)
+              { return a.seq < b.seq; });
+
+    // 按全局顺序把地址换算为对象编号; 轨迹开始前分配的对象的释放无法回放, 跳过
+    std::unordered_map<uint64_t, uint64_t> live;
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        const TraceRecord &r = records[i];
+        ReplayOp op;
+        op.size = r.size;
+        op.op = r.op;
+
+        if (r.op == cmp::trace::kTraceAlloc)
+        {
+            op.object = trace.objects++;
+            live[r.ptrId] = op.object;
+        }
+        else
+        {
+            std::unordered_map<uint64_t, uint64_t>::iterator it = live.find(r.ptrId);
+            if (it == live.end())
+            {
+                trace.skipped_frees++;
+                continue;
+            }
+            op.object = it->second;
+            live.erase(it);
+        }
+
+        if (r.thread >= trace.threads.size())
+        {
+            trace.threads.resize(r.thread + 1);
+            trace.positions.resize(r.thread + 1);
+        }
+        trace.threads[r.thread].push_back(op);
+        trace.positions[r.thread].push_back(trace.total_ops++);
+    }
+
+    return true;
+}
+
+static void ReplayWorker(const Config &config,
+                         const std::vector<ReplayOp> &ops,
+                         const std::vector<uint64_t> &positions,
+                         AllocFn alloc_fn,
+                         FreeFn free_fn,
+                         std::vector<std::atomic<void *>> &objects,
+                         std::atomic<uint64_t> &turn,
+                         std::atomic<bool> &start_flag)
+{
+    bool strict = config.order == "strict";
+    while (!start_flag.load(std::memory_order_acquire))
+    {
+        std::this_thread::yield();
+    }
+
+    for (size_t i = 0; i < ops.size(); ++i)
+    {
+        const ReplayOp &op = ops[i];
+        if (strict)
+        {
+            while (turn.load(std::memory_order_acquire) != positions[i])
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        if (op.op == cmp::trace::kTraceAlloc)
+        {
+            void *ptr = alloc_fn(op.size);
+            if (ptr != nullptr)
+            {
+                *reinterpret_cast<volatile char *>(ptr) = 1;
+            }
+            objects[op.object].store(ptr, std::memory_order_release);
+        }
+        else
+        {
+            void *ptr = objects[op.object].load(std::memory_order_acquire);
+            while (ptr == nullptr)
+            {
+                // thread 模式下跨线程释放需要等待分配线程先执行到
+                std::this_thread::yield();
+                ptr = objects[op.object].load(std::memory_order_acquire);
+            }
+            objects[op.object].store(nullptr, std::memory_order_relaxed);
+            free_fn(ptr, op.size);
+        }
+
+        if (strict)
+        {
+            turn.store(positions[i] + 1, std::memory_order_release);
+        }
+    }
+}
+
+static ReplayResult RunReplay(const Config &config, const Trace &trace)
+{
+    AllocFn alloc_fn = config.plugin.alloc;
+    FreeFn free_fn = config.plugin.free;
+
+    ReplayResult result;
+    for (size_t round = 0; round < config.repeat; ++round)
+    {
+        std::vector<std::atomic<void *>> objects(trace.objects);
+        for (size_t i = 0; i < objects.size(); ++i)
+        {
+            objects[i].store(nullptr, std::memory_order_relaxed);
+        }
+
+        std::atomic<uint64_t> turn(0);
+        std::atomic<bool> start_flag(false);
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < trace.threads.size(); ++t)
+        {
+            workers.push_back(std::thread(
+                ReplayWorker,
+                std::ref(config),
+                std::ref(trace.threads[t]),
+                std::ref(trace.positions[t]),
+                alloc_fn,
+                free_fn,
+                std::ref(objects),
+                std::ref(turn),
+                std::ref(start_flag)));
+        }
+
+        SteadyClock::time_point begin = SteadyClock::now();
+        start_flag.store(true, std::memory_order_release);
+        for (size_t t = 0; t < workers.size(); ++t)
+        {
+            workers[t].join();
+        }
+        SteadyClock::time_point end = SteadyClock::now();
+        result.seconds += std::chrono::duration_cast<std::chrono::duration<double>>(end - begin).count();
+        result.ops += trace.total_ops;
+
+        // 轨迹结束时仍存活的对象 (程序退出前未释放) 在这里统一释放
+        for (size_t t = 0; t < trace.threads.size(); ++t)
+        {
+            for (size_t i = 0; i < trace.threads[t].size(); ++i)
+            {
+                const ReplayOp &op = trace.threads[t][i];
+                void *ptr = objects[op.object].load(std::memory_order_relaxed);
+                if (op.op == cmp::trace::kTraceAlloc && ptr != nullptr)
+                {
+                    free_fn(ptr, op.size);
+                    objects[op.object].store(nullptr, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    if (result.seconds > 0.0)
+    {
+        result.ops_per_sec = static_cast<double>(result.ops) / result.seconds;
+    }
+    return result;
+}
+
+static bool AppendCsv(const Config &config, const Trace &trace, const ReplayResult &result, std::string &error)
+{
+    if (config.csv_path.empty())
+    {
+        return true;
+    }
+
+    bool write_header = true;
+    {
+        std::ifstream existing(config.csv_path.c_str(), std::ios::in);
+        if (existing.good())
+        {
+            existing.peek();
+            if (!existing.eof())
+            {
+                write_header = false;
+            }
+        }
+    }
+
+    std::ofstream out(config.csv_path.c_str(), std::ios::app);
+    if (!out.is_open())
+    {
+        error = "Failed to open csv file: " + config.csv_path;
+        return false;
+    }
+
+    if (write_header)
+    {
+        out << "label,trace,allocator,order,repeat,threads,ops,seconds,ops_per_sec\n";
+    }
+
+    out << config.label << ','
+        << config.trace_path << ','
+        << config.allocator << ','
+        << config.order << ','
+        << config.repeat << ','
+        << trace.threads.size() << ','
+        << result.ops << ','
+        << result.seconds << ','
+        << result.ops_per_sec << '\n';
+    return true;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Config config;
+    std::string error;
+    if (!ParseArgs(argc, argv, config, error))
+    {
+        std::cerr << "Argument error: " << error << '\n';
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    Trace trace;
+    if (!LoadTrace(config.trace_path, trace, error))
+    {
+        std::cerr << error << '\n';
+        return 2;
+    }
+
+    ReplayResult result = RunReplay(config, trace);
+
+    std::cout << "=== trace_replay ===\n";
+    std::cout << "label: " << config.label << '\n';
+    std::cout << "trace: " << config.trace_path
+              << ", threads: " << trace.threads.size()
+              << ", ops: " << trace.total_ops
+              << ", objects: " << trace.objects
+              << ", skipped_frees: " << trace.skipped_frees << '\n';
+    std::cout << "allocator: " << config.allocator
+              << ", order: " << config.order
+              << ", repeat: " << config.repeat << '\n';
+    std::cout << "seconds: " << result.seconds
+              << ", throughput_ops_per_sec: " << result.ops_per_sec << '\n';
+
+    if (!AppendCsv(config, trace, result, error))
+    {
+        std::cerr << error << '\n';
+        return 2;
+    }
+    return 0;
+}
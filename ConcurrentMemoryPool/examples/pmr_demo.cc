@@ -0,0 +1,67 @@
+#include <cassert>
+#include <iostream>
+#include <memory_resource>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "MemoryResource.hpp"
+
+struct alignas(64) CacheLine
+{
+    char data[64];
+};
+
+int main()
+{
+    // 全局内存池
+    std::pmr::vector<int> values(cmp::GetPoolResource());
+    for (int i = 0; i < 100000; ++i)
+    {
+        values.push_back(i);
+    }
+    std::cout << "pool_resource vector size: " << values.size() << ", last=" << values.back() << std::endl;
+
+    // 按尺寸类的共享资源, 上游为全局内存池; 多线程共用同一个资源
+    cmp::size_class_pool_resource shared;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 4; ++t)
+    {
+        workers.push_back(std::thread([&shared, t]()
+                                      {
+            std::pmr::unordered_map<int, std::pmr::string> table(&shared);
+            for (int i = 0; i < 10000; ++i)
+            {
+                table.emplace(i, std::pmr::string("value-" + std::to_string(i * t), &shared));
+            }
+            assert(table.size() == 10000); }));
+    }
+    for (size_t t = 0; t < workers.size(); ++t)
+    {
+        workers[t].join();
+    }
+
+    // 超对齐类型
+    std::pmr::vector<CacheLine> lines(&shared);
+    lines.resize(1000);
+    assert(reinterpret_cast<uintptr_t>(lines.data()) % alignof(CacheLine) == 0);
+    std::cout << "size_class_pool_resource largest block: " << shared.options().largest_required_pool_block << std::endl;
+
+    // 请求级别的单调资源, 析构时按 span 整体归还
+    {
+        cmp::monotonic_span_resource request;
+        std::pmr::vector<std::pmr::string> logs(&request);
+        for (int i = 0; i < 1000; ++i)
+        {
+            logs.emplace_back("request log line that does not fit in sso " + std::to_string(i));
+        }
+        std::pmr::vector<char> blob(4 << 20, 'x', &request); // 超过单个 span, 交给 upstream
+        std::cout << "monotonic_span_resource spans: " << request.arena().SpanCount()
+                  << ", bytes: " << request.arena().BytesAllocated() << std::endl;
+    }
+
+    shared.release();
+    std::cout << "mapped bytes: " << SystemAllocBytes().load() << std::endl;
+    return 0;
+}